@@ -0,0 +1,190 @@
+#ifndef __BLOCK_HELPERS_H_
+#define __BLOCK_HELPERS_H_
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include "Jagged.h"
+#include "VcHelpers.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * BLOCK-AT-A-TIME EXECUTION FOR SCALAR STREAMS
+ *
+ * Instead of pushing one event at a time through the whole chain, a block of
+ * events is decoded into one array per tuple element (struct-of-arrays) and
+ * each stage then runs as a tight loop over the block.  Filters do not move
+ * data; they shrink a selection vector that is carried to later stages.
+ */
+
+/**
+ * The list of rows in a block still alive after the filters run so far.
+ * While no row has been dropped the selection is "dense" and loops run over
+ * [0, size) directly, which is what the auto-vectorizer likes best.
+ */
+class TBlockSelection {
+  public:
+    void reset(std::size_t size) {
+        m_size = size;
+        m_count = size;
+        m_dense = true;
+        if (m_index.size() < size) {m_index.resize(size);}
+    }
+
+    std::size_t size() const {return m_size;}
+    std::size_t count() const {return m_count;}
+    bool dense() const {return m_dense;}
+    bool empty() const {return !m_count;}
+
+    /**
+     * Call fn(row) for each selected row, in order.
+     */
+    template<typename F>
+    void for_each(F &&fn) const {
+        if (m_dense) {
+            for (std::size_t idx=0; idx<m_size; idx++) {fn(idx);}
+        } else {
+            for (std::size_t idx=0; idx<m_count; idx++) {fn(m_index[idx]);}
+        }
+    }
+
+    /**
+     * Keep only the rows for which pass(row) is true.  The index list is
+     * rewritten in place without branching on the result.
+     */
+    template<typename F>
+    void refine(F &&pass) {
+        std::size_t kept = 0;
+        if (m_dense) {
+            for (std::size_t idx=0; idx<m_size; idx++) {
+                m_index[kept] = idx;
+                kept += pass(idx) ? 1 : 0;
+            }
+        } else {
+            for (std::size_t idx=0; idx<m_count; idx++) {
+                std::size_t row = m_index[idx];
+                m_index[kept] = row;
+                kept += pass(row) ? 1 : 0;
+            }
+        }
+        m_dense = (kept == m_size);
+        m_count = kept;
+    }
+
+  private:
+    std::vector<unsigned> m_index;
+    std::size_t m_size{0};
+    std::size_t m_count{0};
+    bool m_dense{true};
+};
+
+/**
+ * Storage for one column of a block.  Columns of spans are flattened into
+ * a TJaggedArray, so the elements of the whole block are contiguous.
+ */
+template<typename T>
+struct block_column {
+    typedef std::vector<T> type;
+
+    // Storage only ever grows, so a block is allocated once per range.
+    static void resize(type &column, std::size_t size) {
+        if (column.size() < size) {column.resize(size);}
+    }
+
+    static void set(type &column, std::size_t idx, const T &value) {column[idx] = value;}
+
+    static void load(type &column, const T *data, std::size_t size) {std::copy(data, data + size, column.begin());}
+};
+
+template<typename T>
+struct block_column<span<T>> {
+    typedef TJaggedArray<T> type;
+
+    static void resize(type &column, std::size_t size) {column.resize(size);}
+
+    static void set(type &column, std::size_t idx, span<T> value) {column.set(idx, value);}
+
+    static void load(type &column, const span<T> *data, std::size_t size) {
+        for (std::size_t idx = 0; idx < size; idx++) {column.set(idx, data[idx]);}
+    }
+};
+
+template<typename ArgTuple, typename Indices = std::make_index_sequence<std::tuple_size<ArgTuple>::value>>
+class TBlockColumns;
+
+/**
+ * One block of tuples stored column-wise.  Rows are addressed by their
+ * offset in the block; mapped blocks keep the row numbering of their input
+ * so that the selection vector stays valid.
+ */
+template<typename... Args, std::size_t... I>
+class TBlockColumns<std::tuple<Args...>, std::index_sequence<I...>> {
+  public:
+    typedef std::tuple<Args...> row_type;
+
+    std::size_t size() const {return m_size;}
+
+    /**
+     * Set the number of rows; storage only ever grows so a block is
+     * allocated once per range.
+     */
+    void resize(std::size_t size) {
+        m_size = size;
+        bool ignore_array[] = {false, (block_column<Args>::resize(std::get<I>(m_columns), size), false)...};
+        (void)ignore_array;
+    }
+
+    row_type row(std::size_t idx) const {
+        return row_type(std::get<I>(m_columns)[idx]...);
+    }
+
+    void set(std::size_t idx, const row_type &value) {
+        bool ignore_array[] = {false, (block_column<Args>::set(std::get<I>(m_columns), idx, std::get<I>(value)), false)...};
+        (void)ignore_array;
+    }
+
+    template<std::size_t J>
+    const typename std::tuple_element<J, row_type>::type *column() const {return std::get<J>(m_columns).data();}
+
+    /**
+     * Copy rows [offset, offset+size) from a columnar source providing
+     * data<J>() pointers (such as TBulkReader) into the block.
+     */
+    template<typename Source>
+    void load(const Source &source, std::size_t offset, std::size_t size) {
+        resize(size);
+        bool ignore_array[] = {false, (block_column<Args>::load(std::get<I>(m_columns), source.template data<I>() + offset, size), false)...};
+        (void)ignore_array;
+    }
+
+    /**
+     * Set out[idx] = fn(row(idx)) for every selected row idx.
+     */
+    template<typename F, typename OutBlock>
+    void transform(F &&fn, OutBlock &out, const TBlockSelection &selection) const {
+        out.resize(m_size);
+        selection.for_each([&](std::size_t idx) {out.set(idx, fn(row(idx)));});
+    }
+
+  private:
+    std::tuple<typename block_column<Args>::type...> m_columns;
+    std::size_t m_size{0};
+};
+
+// Placeholder for stages whose input is never materialized as a block
+// (e.g. vectorized tuples after a packer); those run event-at-a-time.
+template<>
+class TBlockColumns<std::tuple<>, std::index_sequence<>> {};
+
+template<typename ArgTuple>
+using block_storage_t = typename std::conditional<is_vectorized_tuple<ArgTuple>::value, TBlockColumns<std::tuple<>>, TBlockColumns<ArgTuple>>::type;
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __BLOCK_HELPERS_H_
@@ -0,0 +1,237 @@
+#ifndef __CLUSTER_INDEX_H_
+#define __CLUSTER_INDEX_H_
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TBranch.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TTree.h"
+
+namespace ROOT {
+
+/*
+ * Exception raised if the user refers to a branch that is not known to the
+ * processor or not found in the tree.
+ */
+class NoSuchBranch : public std::exception {
+
+  public:
+    NoSuchBranch(const std::string &branch, const std::string &where) {
+      std::stringstream ss;
+      ss << "No branch named " << branch << " in " << where;
+      m_msg = ss.str();
+    }
+
+    virtual const char *what() const noexcept override {return m_msg.c_str();}
+
+  private:
+    std::string m_msg;
+};
+
+/**
+ * A zone map for a tree: the minimum, maximum and NaN count of chosen
+ * numeric branches for each cluster.
+ *
+ * The index is built once by a dedicated pass over the tree and saved in a
+ * sidecar file next to the data (see sidecar()), tagged with the UUID of
+ * the file it describes so that a rewritten file never uses a stale index.  Range filters added with
+ * TTreeProcessor::filterRange consult it to skip whole clusters that cannot
+ * hold a passing event; these clusters are never read.  Clusters of time-
+ * or run-ordered data tend to cover narrow ranges, so most can be skipped.
+ */
+class TClusterIndex {
+  public:
+    // A cut lo <= branch <= hi, as added by filterRange.
+    struct Cut {
+      std::string branch;
+      double lo;
+      double hi;
+    };
+
+    // Statistics of one branch over one cluster; NaNs are not included in
+    // min / max.
+    struct Zone {
+      double min{std::numeric_limits<double>::infinity()};
+      double max{-std::numeric_limits<double>::infinity()};
+      Long64_t nan{0};
+
+      void add(double value) {
+        if (std::isnan(value)) {nan++; return;}
+        min = std::min(min, value);
+        max = std::max(max, value);
+      }
+
+      // Whether any value of the cluster may fall in [lo, hi].
+      bool overlaps(double lo, double hi) const {return max >= lo && min <= hi;}
+    };
+
+    TClusterIndex() {}
+
+    /**
+     * Scan the tree and record the zone of each listed branch for every
+     * cluster.  Each branch must hold a single numeric leaf.
+     */
+    static TClusterIndex build(TTree *tree, const std::vector<std::string> &branches) {
+      TClusterIndex index;
+      index.m_uuid = file_uuid(tree);
+      index.m_entries = tree->GetEntries();
+      index.m_branches = branches;
+
+      std::vector<TLeaf*> leaves;
+      for (const auto &name : branches) {
+          TLeaf *leaf = tree->GetLeaf(name.c_str());
+          if (!leaf) {throw NoSuchBranch(name, tree->GetName());}
+          leaves.push_back(leaf);
+      }
+
+      TTree::TClusterIterator clusterIter = tree->GetClusterIterator(0);
+      Long64_t clusterStart;
+      while ( (clusterStart = clusterIter()) < index.m_entries ) {
+          index.m_boundaries.push_back(clusterStart);
+          std::vector<Zone> zones(leaves.size());
+          for (std::size_t idx = 0; idx < leaves.size(); idx++) {
+              TBranch *branch = leaves[idx]->GetBranch();
+              for (Long64_t entry = clusterStart; entry < clusterIter.GetNextEntry(); entry++) {
+                  branch->GetEntry(entry);
+                  zones[idx].add(leaves[idx]->GetValue());
+              }
+          }
+          index.m_zones.push_back(std::move(zones));
+      }
+      index.m_boundaries.push_back(index.m_entries);
+      index.m_valid = true;
+      return index;
+    }
+
+    /**
+     * The conventional location of the index for a tree in a given file.
+     */
+    static std::string sidecar(const std::string &fileName, const std::string &treeName) {
+      return fileName + "." + treeName + ".zonemap";
+    }
+
+    bool save(const std::string &fileName) const {
+      std::ofstream out(fileName);
+      out.precision(std::numeric_limits<double>::max_digits10);
+      out << "zonemap 2\n" << m_uuid << "\n" << m_entries << " " << m_branches.size();
+      for (const auto &name : m_branches) {out << " " << name;}
+      out << "\n" << m_zones.size() << "\n";
+      for (std::size_t cluster = 0; cluster < m_zones.size(); cluster++) {
+          out << m_boundaries[cluster] << " " << m_boundaries[cluster+1];
+          for (const auto &zone : m_zones[cluster]) {
+              // An all-NaN zone has infinite bounds, which don't round-trip.
+              bool empty = zone.min > zone.max;
+              out << " " << (empty ? 0 : zone.min) << " " << (empty ? 0 : zone.max) << " " << zone.nan;
+          }
+          out << "\n";
+      }
+      return static_cast<bool>(out);
+    }
+
+    /**
+     * Read an index written by save(); the result is invalid if the file is
+     * missing or malformed.
+     */
+    static TClusterIndex load(const std::string &fileName) {
+      TClusterIndex index;
+      std::ifstream in(fileName);
+      std::string magic;
+      int version = 0;
+      std::size_t branchCount = 0, clusterCount = 0;
+      if (!(in >> magic >> version) || magic != "zonemap" || version != 2) {return TClusterIndex();}
+      if (!(in >> index.m_uuid)) {return TClusterIndex();}
+      if (!(in >> index.m_entries >> branchCount)) {return TClusterIndex();}
+      index.m_branches.resize(branchCount);
+      for (auto &name : index.m_branches) {in >> name;}
+      if (!(in >> clusterCount)) {return TClusterIndex();}
+      for (std::size_t cluster = 0; cluster < clusterCount; cluster++) {
+          Long64_t start, end;
+          in >> start >> end;
+          std::vector<Zone> zones(branchCount);
+          for (auto &zone : zones) {
+              in >> zone.min >> zone.max >> zone.nan;
+              if (zone.nan == end - start) {zone = Zone(); zone.nan = end - start;}
+          }
+          index.m_boundaries.push_back(start);
+          index.m_zones.push_back(std::move(zones));
+          if (cluster + 1 == clusterCount) {index.m_boundaries.push_back(end);}
+      }
+      if (!in) {return TClusterIndex();}
+      index.m_valid = true;
+      return index;
+    }
+
+    bool valid() const {return m_valid;}
+    std::size_t clusters() const {return m_zones.size();}
+    const std::vector<std::string> &branches() const {return m_branches;}
+
+    /**
+     * Whether the index describes this tree: same file, same entries, same
+     * clusters.
+     */
+    bool matches(TTree *tree) const {
+      if (!m_valid || file_uuid(tree) != m_uuid || tree->GetEntries() != m_entries) {return false;}
+      TTree::TClusterIterator clusterIter = tree->GetClusterIterator(0);
+      Long64_t clusterStart;
+      std::size_t cluster = 0;
+      while ( (clusterStart = clusterIter()) < m_entries ) {
+          if (cluster >= clusters() || m_boundaries[cluster++] != clusterStart) {return false;}
+      }
+      return cluster == clusters();
+    }
+
+    /**
+     * The entry ranges that may hold events passing all the cuts, with
+     * adjacent clusters merged.  Cuts on branches that are not indexed
+     * never skip anything.
+     */
+    std::vector<std::pair<Long64_t, Long64_t>> select(const std::vector<Cut> &cuts) const {
+      std::vector<std::pair<std::size_t, const Cut*>> indexed;
+      for (const auto &cut : cuts) {
+          for (std::size_t idx = 0; idx < m_branches.size(); idx++) {
+              if (m_branches[idx] == cut.branch) {indexed.emplace_back(idx, &cut);}
+          }
+      }
+
+      std::vector<std::pair<Long64_t, Long64_t>> ranges;
+      for (std::size_t cluster = 0; cluster < clusters(); cluster++) {
+          bool keep = true;
+          for (const auto &cut : indexed) {
+              keep = keep && m_zones[cluster][cut.first].overlaps(cut.second->lo, cut.second->hi);
+          }
+          if (!keep) {continue;}
+          if (!ranges.empty() && ranges.back().second == m_boundaries[cluster]) {
+              ranges.back().second = m_boundaries[cluster+1];
+          } else {
+              ranges.emplace_back(m_boundaries[cluster], m_boundaries[cluster+1]);
+          }
+      }
+      return ranges;
+    }
+
+  private:
+    // The UUID of the tree's file; a file rewritten in place gets a new one.
+    static std::string file_uuid(TTree *tree) {
+      TFile *file = tree->GetCurrentFile();
+      return file ? file->GetUUID().AsString() : "-";
+    }
+
+    bool m_valid{false};
+    std::string m_uuid;
+    Long64_t m_entries{0};
+    std::vector<std::string> m_branches;
+    std::vector<Long64_t> m_boundaries;
+    std::vector<std::vector<Zone>> m_zones;
+};
+
+}  // namespace ROOT
+
+#endif  // __CLUSTER_INDEX_H_
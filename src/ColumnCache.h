@@ -0,0 +1,152 @@
+#ifndef __COLUMN_CACHE_H_
+#define __COLUMN_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Rtypes.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * DECODED-COLUMN CACHE
+ *
+ * The decoded values of one primitive branch, kept uncompressed in a local
+ * file mapped into memory.  Ranges are filled in as the bulk reader first
+ * decodes them; later reads of a filled range are served straight from the
+ * mapping, without reading or decompressing the baskets.
+ *
+ * File layout: a header, then a bitmap with one bit per entry telling
+ * whether that entry has been filled, then the values (page-aligned, padded
+ * by Padding entries so that vector loads may run past the last entry).
+ * A file with an unexpected header is recreated.
+ */
+template<typename T, std::size_t Padding>
+class TColumnCacheFile {
+  public:
+    TColumnCacheFile(const std::string &path, const char *typeName, Long64_t entries) :
+      m_entries(entries),
+      m_data_offset(round_up(sizeof(Header) + bitmap_words()*sizeof(std::uint64_t), page_size())),
+      m_size(round_up(m_data_offset + (entries + Padding)*sizeof(T), page_size()))
+    {
+        Header expected;
+        std::strncpy(expected.type, typeName, sizeof(expected.type) - 1);
+        expected.entries = entries;
+        expected.data_offset = m_data_offset;
+        if (!map(path, expected)) {
+            // Write a fresh file aside and move it in place, so that no one
+            // maps a half-initialized cache.
+            std::string tmp = path + ".XXXXXX";
+            std::vector<char> name(tmp.begin(), tmp.end());
+            name.push_back('\0');
+            int fd = mkstemp(name.data());
+            if (fd < 0) {return;}
+            bool ok = (ftruncate(fd, m_size) == 0) && (pwrite(fd, &expected, sizeof(expected), 0) == sizeof(expected));
+            close(fd);
+            if (!ok || rename(name.data(), path.c_str()) != 0) {
+                unlink(name.data());
+                return;
+            }
+            map(path, expected);
+        }
+    }
+
+    ~TColumnCacheFile() {
+        if (m_map) {munmap(m_map, m_size);}
+    }
+
+    TColumnCacheFile(const TColumnCacheFile&) = delete;
+    TColumnCacheFile& operator=(const TColumnCacheFile&) = delete;
+
+    bool valid() const {return m_map;}
+
+    const T *data() const {return reinterpret_cast<const T*>(static_cast<char*>(m_map) + m_data_offset);}
+
+    /**
+     * Whether every entry of [start, end) has been filled.
+     */
+    bool covers(Long64_t start, Long64_t end) const {
+        for (Long64_t entry = start; entry < end; ) {
+            Long64_t word = entry / 64;
+            std::uint64_t mask = bits(entry, end);
+            if ((__atomic_load_n(bitmap() + word, __ATOMIC_ACQUIRE) & mask) != mask) {return false;}
+            entry = (word + 1) * 64;
+        }
+        return true;
+    }
+
+    /**
+     * Copy the decoded values of [start, end) into the cache; they are
+     * visible to covers() once written.
+     */
+    void store(Long64_t start, Long64_t end, const T *values) {
+        std::memcpy(static_cast<char*>(m_map) + m_data_offset + start*sizeof(T), values, (end - start)*sizeof(T));
+        for (Long64_t entry = start; entry < end; ) {
+            Long64_t word = entry / 64;
+            __atomic_fetch_or(bitmap() + word, bits(entry, end), __ATOMIC_RELEASE);
+            entry = (word + 1) * 64;
+        }
+    }
+
+  private:
+    struct Header {
+      char magic[8] = {'T', 'T', 'P', 'C', 'A', 'C', 'H', 'E'};
+      char type[16] = {};
+      Long64_t entries{0};
+      Long64_t data_offset{0};
+    };
+
+    static std::size_t page_size() {return sysconf(_SC_PAGESIZE);}
+    static std::size_t round_up(std::size_t size, std::size_t align) {return ((size + align - 1) / align) * align;}
+
+    Long64_t bitmap_words() const {return (m_entries + 63) / 64;}
+    std::uint64_t *bitmap() const {return reinterpret_cast<std::uint64_t*>(static_cast<char*>(m_map) + sizeof(Header));}
+
+    // The bits of word entry/64 covering entries [entry, end).
+    static std::uint64_t bits(Long64_t entry, Long64_t end) {
+        Long64_t first = entry % 64;
+        Long64_t last = std::min<Long64_t>(64, first + (end - entry));
+        std::uint64_t high = (last == 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << last) - 1);
+        return high & ~((std::uint64_t(1) << first) - 1);
+    }
+
+    // Map an existing cache file; false if it is missing or does not match.
+    bool map(const std::string &path, const Header &expected) {
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0) {return false;}
+        struct stat info;
+        Header header;
+        if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) != m_size ||
+            pread(fd, &header, sizeof(header), 0) != sizeof(header) || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+            close(fd);
+            return false;
+        }
+        void *mapped = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {return false;}
+        m_map = mapped;
+        return true;
+    }
+
+    Long64_t m_entries;
+    std::size_t m_data_offset;
+    std::size_t m_size;
+    void *m_map{nullptr};
+};
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __COLUMN_CACHE_H_
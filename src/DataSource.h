@@ -0,0 +1,199 @@
+#ifndef __DATA_SOURCE_H_
+#define __DATA_SOURCE_H_
+
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "RootHelpers.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * Common part of the sources a TTreeProcessor can run over in place of a
+ * tree.  A source of BranchTypes has a number of entries and a name (used
+ * as the "file" of its entries, e.g. by collect()), and serves entries
+ * [start, end) as a TBulkChunk<BranchTypes> through
+ *
+ *   void fill(Long64_t start, Long64_t end, TBulkChunk<BranchTypes> &chunk) const;
+ *
+ * which may be called from several threads at once.  Processors hand out
+ * ranges of chunk_size entries, starting from entry 0.
+ */
+class TDataSourceBase {
+  public:
+    // Entries per fill; a multiple of vector_count.
+    static const Long64_t chunk_size = 4096;
+
+    Long64_t entries() const {return m_entries;}
+    const std::string &name() const {return m_name;}
+
+  protected:
+    TDataSourceBase(const std::string &name, Long64_t entries) : m_name(name), m_entries(entries) {}
+
+  private:
+    std::string m_name;
+    Long64_t m_entries;
+};
+
+template<typename T>
+struct is_data_source : std::is_base_of<TDataSourceBase, T> {};
+
+// Sources serve their columns as TBulkChunk buffers, and std::vector<bool>
+// stores no array of bool to point into: bool columns are not supported.
+template<typename BranchTypes>
+struct has_bool_column;
+
+template<typename... Args>
+struct has_bool_column<std::tuple<Args...>> : std::integral_constant<bool, !all_true<!std::is_same<Args, bool>::value...>::value> {};
+
+/**
+ * The distribution TSyntheticSource draws values of type T from unless
+ * told otherwise: uniform in [0, 1) for floating-point types, uniform in
+ * [0, 100) for integers.
+ */
+template<typename T, bool IsFloat = std::is_floating_point<T>::value>
+struct default_distribution {
+    typedef std::uniform_int_distribution<long long> type;
+    static type make() {return type(0, 99);}
+};
+
+template<typename T>
+struct default_distribution<T, true> {
+    typedef std::uniform_real_distribution<T> type;
+    static type make() {return type(0, 1);}
+};
+
+template<typename BranchTypes>
+struct default_distributions;
+
+template<typename... Args>
+struct default_distributions<std::tuple<Args...>> {
+    typedef std::tuple<typename default_distribution<Args>::type...> type;
+    static type make() {return type(default_distribution<Args>::make()...);}
+};
+
+}  // namespace internal
+
+template<typename BranchTypes, typename Indices = std::make_index_sequence<std::tuple_size<BranchTypes>::value>>
+class TMemorySource;
+
+/**
+ * Events already held in memory, one array per element of BranchTypes
+ * (struct-of-arrays, like the result of collect()).  The arrays are not
+ * copied and must outlive the processing; chains run over them read no
+ * file at all.
+ *
+ *   std::vector<float> pt = ...;
+ *   std::vector<int> charge = ...;
+ *   TMemorySource<std::tuple<float, int>> source(pt, charge);
+ *   processor.map(...).processParallel(source);
+ */
+template<typename BranchTypes, std::size_t... I>
+class TMemorySource<BranchTypes, std::index_sequence<I...>> : public internal::TDataSourceBase {
+    static_assert(!internal::has_bool_column<BranchTypes>::value, "Sources do not support bool columns; store them as UChar_t.");
+
+  public:
+    // Columns of entries values each.
+    TMemorySource(Long64_t entries, const typename std::tuple_element<I, BranchTypes>::type *... columns) :
+        internal::TDataSourceBase("memory", entries),
+        m_columns(columns...)
+    {}
+
+    // Columns held in vectors, which must all have the same size.
+    TMemorySource(const std::vector<typename std::tuple_element<I, BranchTypes>::type> &... columns) :
+        TMemorySource(common_size({static_cast<Long64_t>(columns.size())...}), columns.data()...)
+    {}
+
+    // The result of collect().
+    TMemorySource(const std::tuple<std::vector<typename std::tuple_element<I, BranchTypes>::type>...> &columns) :
+        TMemorySource(std::get<I>(columns)...)
+    {}
+
+    void fill(Long64_t start, Long64_t end, internal::TBulkChunk<BranchTypes> &chunk) const {
+        chunk.assign(start, end - start, (std::get<I>(m_columns) + start)...);
+    }
+
+  private:
+    static Long64_t common_size(std::initializer_list<Long64_t> sizes) {
+        for (auto size : sizes) {
+            if (size != *sizes.begin()) {throw std::invalid_argument("TMemorySource columns differ in size");}
+        }
+        return sizes.size() ? *sizes.begin() : 0;
+    }
+
+    std::tuple<const typename std::tuple_element<I, BranchTypes>::type*...> m_columns;
+};
+
+template<typename BranchTypes,
+         typename Distributions = typename internal::default_distributions<BranchTypes>::type,
+         typename Indices = std::make_index_sequence<std::tuple_size<BranchTypes>::value>>
+class TSyntheticSource;
+
+/**
+ * A given number of random events, generated as they are processed: each
+ * element of BranchTypes is drawn from the matching element of
+ * Distributions (standard-library random number distributions).  Chains
+ * run over it measure compute throughput alone, without any I/O.
+ *
+ * The values of a range of entries only depend on the seed and the range's
+ * first entry, and processors always split a source at the same entries,
+ * so process and processParallel see the same events.
+ *
+ *   TSyntheticSource<std::tuple<float, int>> source(10000000, 42);
+ *   auto normal = make_synthetic_source<std::tuple<float>>(1000000, 42, std::normal_distribution<float>(0, 1));
+ */
+template<typename BranchTypes, typename Distributions, std::size_t... I>
+class TSyntheticSource<BranchTypes, Distributions, std::index_sequence<I...>> : public internal::TDataSourceBase {
+    static_assert(!internal::has_bool_column<BranchTypes>::value, "Sources do not support bool columns; store them as UChar_t.");
+
+  public:
+    TSyntheticSource(Long64_t entries, std::uint64_t seed = 0, const Distributions &distributions = internal::default_distributions<BranchTypes>::make()) :
+        internal::TDataSourceBase("synthetic:" + std::to_string(seed), entries),
+        m_seed(seed),
+        m_distributions(distributions)
+    {}
+
+    void fill(Long64_t start, Long64_t end, internal::TBulkChunk<BranchTypes> &chunk) const {
+        chunk.allocate(start, end - start);
+        bool ignore[] = {false, (generate<I>(start, end - start, chunk.template buffer<I>()), false)...};
+        (void)ignore;
+    }
+
+  private:
+    // Column J of the range starting at entry start: one engine per column
+    // and range, so ranges can be generated on any thread in any order.
+    template<std::size_t J, typename T>
+    void generate(Long64_t start, Long64_t size, T *values) const {
+        std::seed_seq seeds{static_cast<std::uint32_t>(m_seed), static_cast<std::uint32_t>(m_seed >> 32),
+                            static_cast<std::uint32_t>(J), static_cast<std::uint32_t>(start), static_cast<std::uint32_t>(start >> 32)};
+        std::mt19937_64 engine(seeds);
+        auto distribution = std::get<J>(m_distributions);
+        for (Long64_t idx = 0; idx < size; idx++) {
+            values[idx] = static_cast<T>(distribution(engine));
+        }
+    }
+
+    std::uint64_t m_seed;
+    Distributions m_distributions;
+};
+
+/**
+ * A TSyntheticSource drawing from the given distributions, one per element
+ * of BranchTypes.
+ */
+template<typename BranchTypes, typename... Distributions>
+TSyntheticSource<BranchTypes, std::tuple<Distributions...>>
+make_synthetic_source(Long64_t entries, std::uint64_t seed, const Distributions &... distributions) {
+    return TSyntheticSource<BranchTypes, std::tuple<Distributions...>>(entries, seed, std::make_tuple(distributions...));
+}
+
+}  // namespace ROOT
+
+#endif  // __DATA_SOURCE_H_
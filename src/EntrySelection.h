@@ -0,0 +1,187 @@
+#ifndef __ENTRY_SELECTION_H_
+#define __ENTRY_SELECTION_H_
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Rtypes.h"
+
+namespace ROOT {
+
+/**
+ * The entries passing a selection, per input file, stored as sorted runs
+ * [start, end) of consecutive entries.
+ *
+ * Written by TTreeProcessor::saveSelection and passed back to process /
+ * processParallel to replay the selection: later passes only read the
+ * selected entries, and baskets holding none of them are never touched.
+ * Files are keyed by their endpoint URL.
+ */
+class TEntrySelection {
+  public:
+    typedef std::vector<std::pair<Long64_t, Long64_t>> runs_type;
+
+    // An invalid selection, as returned by a failed load().
+    TEntrySelection() {}
+
+    // An empty selection, valid if `valid`, to be filled with file_runs().
+    explicit TEntrySelection(bool valid) : m_valid(valid) {}
+
+    /**
+     * Append entry to a list of runs; entries must come in increasing order.
+     */
+    static void append(runs_type &runs, Long64_t entry) {
+      if (!runs.empty() && runs.back().second == entry) {
+        runs.back().second++;
+      } else {
+        runs.emplace_back(entry, entry + 1);
+      }
+    }
+
+    // The (writable) runs of a file.
+    runs_type &file_runs(const std::string &file) {return m_files[file];}
+
+    // The runs of a file; empty if no entry of the file is selected.
+    const runs_type &runs(const std::string &file) const {
+      static const runs_type none;
+      auto iter = m_files.find(file);
+      return iter == m_files.end() ? none : iter->second;
+    }
+
+    /**
+     * Add the runs of another selection, e.g. recorded on another thread.
+     */
+    void merge(const TEntrySelection &other) {
+      for (const auto &file : other.m_files) {
+          auto &runs = m_files[file.first];
+          runs.insert(runs.end(), file.second.begin(), file.second.end());
+      }
+      normalize();
+    }
+
+    // Sort the runs of each file and join the adjacent ones.
+    void normalize() {
+      for (auto &file : m_files) {
+          auto &runs = file.second;
+          std::sort(runs.begin(), runs.end());
+          runs_type joined;
+          for (const auto &run : runs) {
+              if (!joined.empty() && joined.back().second >= run.first) {
+                joined.back().second = std::max(joined.back().second, run.second);
+              } else {
+                joined.push_back(run);
+              }
+          }
+          runs.swap(joined);
+      }
+    }
+
+    void clear() {m_files.clear();}
+
+    // Number of selected entries over all files.
+    Long64_t count() const {
+      Long64_t total = 0;
+      for (const auto &file : m_files) {
+          for (const auto &run : file.second) {total += run.second - run.first;}
+      }
+      return total;
+    }
+
+    bool save(const std::string &fileName) const {
+      std::ofstream out(fileName);
+      out << "selection 1\n" << m_files.size() << "\n";
+      for (const auto &file : m_files) {
+          out << std::quoted(file.first) << " " << file.second.size() << "\n";
+          for (const auto &run : file.second) {out << run.first << " " << run.second << "\n";}
+      }
+      return static_cast<bool>(out);
+    }
+
+    /**
+     * Read a selection written by save(); valid() is false if the file is
+     * missing or malformed.
+     */
+    static TEntrySelection load(const std::string &fileName) {
+      TEntrySelection selection;
+      std::ifstream in(fileName);
+      std::string magic;
+      int version = 0;
+      std::size_t fileCount = 0;
+      if (!(in >> magic >> version >> fileCount) || magic != "selection" || version != 1) {return TEntrySelection();}
+      for (std::size_t idx = 0; idx < fileCount; idx++) {
+          std::string file;
+          std::size_t runCount = 0;
+          in >> std::quoted(file) >> runCount;
+          auto &runs = selection.m_files[file];
+          runs.resize(runCount);
+          for (auto &run : runs) {in >> run.first >> run.second;}
+      }
+      if (!in) {return TEntrySelection();}
+      selection.m_valid = true;
+      return selection;
+    }
+
+    bool valid() const {return m_valid;}
+
+  private:
+    bool m_valid{false};
+    std::map<std::string, runs_type> m_files;
+};
+
+namespace internal {
+
+// Every entry of a range is processed.
+struct TAllEntries {
+    static constexpr bool all = true;
+    bool selected(Long64_t) const {return true;}
+    Long64_t next(Long64_t entry, Long64_t) const {return entry;}
+    Long64_t last(Long64_t, Long64_t end) const {return end;}
+};
+
+/**
+ * The entries of a range that fall in runs [begin, end) of a selection.
+ * A replay reads the runs of a cluster as one range and skips the entries
+ * between them, and the bulk reader only decodes the stretches holding
+ * selected entries; entries must be asked about in increasing order.
+ */
+class TSelectedEntries {
+  public:
+    typedef TEntrySelection::runs_type::const_iterator iterator;
+
+    static constexpr bool all = false;
+
+    TSelectedEntries(iterator begin, iterator end) : m_run(begin), m_end(end) {}
+
+    bool selected(Long64_t entry) {
+      while (m_run != m_end && m_run->second <= entry) {++m_run;}
+      return m_run != m_end && m_run->first <= entry;
+    }
+
+    // The first selected entry of [entry, end); end if there is none.
+    Long64_t next(Long64_t entry, Long64_t end) {
+      while (m_run != m_end && m_run->second <= entry) {++m_run;}
+      return m_run == m_end ? end : std::min(end, std::max(entry, m_run->first));
+    }
+
+    // One past the last selected entry of [entry, end), for a selected entry.
+    Long64_t last(Long64_t entry, Long64_t end) const {
+      Long64_t result = entry;
+      for (auto run = m_run; run != m_end && run->first < end; ++run) {result = std::min(run->second, end);}
+      return result;
+    }
+
+  private:
+    iterator m_run;
+    iterator m_end;
+};
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __ENTRY_SELECTION_H_
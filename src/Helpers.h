@@ -4,6 +4,7 @@
 
 #include <string>
 #include <tuple>
+#include <utility>
 
 #include "TTreeProcessorKernels.h"
 
@@ -126,6 +127,7 @@ struct result_of_unpacked_tuple {
  *
  * - If F derives from TTreeProcessorMapperBase, then apply the unpacked tuple to the
  *   class's map function.
+ * - If F derives from TTreeProcessorEmitterBase, the output is F::output_type.
  * - Otherwise, assume that the class descends from TTreeProcessorFilterBase and assume.
  *   the stream's types are unchanged (as the filter simply removes events,
  *   not changes types).
@@ -143,21 +145,28 @@ struct ProcessorApplyHelper<1, F, InputArg> {
   typedef typename result_of_unpacked_tuple<F, InputArg>::type type;
 };
 
+template<typename F, typename InputArg>
+struct ProcessorApplyHelper<2, F, InputArg> {
+  typedef typename F::output_type type;
+};
+
 template<typename F, typename InputArg>
 struct ProcessorApply {
-  static const unsigned int is_mapper = std::is_base_of<ROOT::internal::TTreeProcessorMapperBase, F>::value;
-  typedef typename ProcessorApplyHelper<is_mapper, F, InputArg>::type type;
+  static const unsigned int stage_type = std::is_base_of<ROOT::internal::TTreeProcessorMapperBase, F>::value ? 1 :
+                                         (std::is_base_of<ROOT::internal::TTreeProcessorEmitterBase, F>::value ? 2 : 0);
+  typedef typename ProcessorApplyHelper<stage_type, F, InputArg>::type type;
 };
 
 template<unsigned int I, unsigned int J, typename InputArg, typename... ProcessingStages>
 struct ProcessorArgHelper;
 
+// I is the offset of F in the original list of stages; walk forward to the Jth.
 template<unsigned int I, unsigned int J, typename InputArg, typename F, typename... ProcessingStages>
 struct ProcessorArgHelper<I,J, InputArg, F, ProcessingStages...> {
-  // This is the input tuple for the Jth function in ProcessingStages.
-  typedef typename ProcessorArgHelper<0, J-1, InputArg, F, ProcessingStages...>::output_type input_type;
   // This is the next input type for ProcessingStages.
-  typedef typename ProcessorArgHelper<0, 0, InputArg, F, ProcessingStages...>::output_type next_input_arg;
+  typedef typename ProcessorApply<F, InputArg>::type next_input_arg;
+  // This is the input tuple for the Jth function in ProcessingStages.
+  typedef typename ProcessorArgHelper<I+1, J, next_input_arg, ProcessingStages...>::input_type input_type;
   // This is the output tuple for the Jth function in ProcessingStages.
   typedef typename ProcessorArgHelper<I+1, J, next_input_arg, ProcessingStages...>::output_type output_type;
 };
@@ -189,7 +198,8 @@ struct ProcessorResult<InputArg> {
 };
 
 /**
- * Given a list of stages, determine whether stage N is a mapper.
+ * Given a list of stages, determine the type of stage N:
+ * 0 for a filter, 1 for a mapper, 2 for an emitter.
  */
 
 template<unsigned int I, unsigned int J, typename F, typename... ProcessingStages>
@@ -199,7 +209,8 @@ struct GetStageTypeHelper {
 
 template<unsigned int N, typename F, typename... ProcessingStages>
 struct GetStageTypeHelper<N, N, F, ProcessingStages...> {
-  static const unsigned int value = std::is_base_of<ROOT::internal::TTreeProcessorMapperBase, F>::value;
+  static const unsigned int value = std::is_base_of<ROOT::internal::TTreeProcessorMapperBase, F>::value ? 1 :
+                                    (std::is_base_of<ROOT::internal::TTreeProcessorEmitterBase, F>::value ? 2 : 0);
 };
 
 template<unsigned int N, typename... ProcessingStages>
@@ -207,22 +218,175 @@ struct GetStageType {
   static const unsigned int value = GetStageTypeHelper<0, N, ProcessingStages...>::value;
 };
 
+/**
+ * The value returned by processing a chain: the result of its terminal
+ * stage, or void if the chain does not end in one.
+ */
+template<typename T, bool IsTerminal = is_terminal_stage<T>::value>
+struct terminal_result {
+  typedef void type;
+};
+
+template<typename T>
+struct terminal_result<T, true> {
+  typedef typename T::result_type type;
+};
+
+template<typename... ProcessingStages>
+struct chain_result {
+  static const bool is_terminated = is_terminal_stage<std::decay_t<typename std::tuple_element<sizeof...(ProcessingStages)-1, std::tuple<ProcessingStages...>>::type>>::value;
+  typedef typename terminal_result<std::decay_t<typename std::tuple_element<sizeof...(ProcessingStages)-1, std::tuple<ProcessingStages...>>::type>>::type type;
+};
+
+template<>
+struct chain_result<> {
+  static const bool is_terminated = false;
+  typedef void type;
+};
+
+/**
+ * Argument types of a member function, decayed, as a std::tuple.
+ */
+template<typename MemFn>
+struct member_args {
+  typedef void type;
+};
+
+template<typename R, typename C, typename... Args>
+struct member_args<R (C::*)(Args...)> {
+  typedef std::tuple<std::decay_t<Args>...> type;
+};
+
+template<typename R, typename C, typename... Args>
+struct member_args<R (C::*)(Args...) const> {
+  typedef std::tuple<std::decay_t<Args>...> type;
+};
+
+// Overload ranking: a function taking rank<N> is preferred over rank<N-1>.
+template<unsigned int N>
+struct rank : rank<N-1> {};
+
+template<>
+struct rank<0> {};
+
+/**
+ * The arguments as declared by a stage: those of the wrapped callable for
+ * lambda stages, else those of the filter or map method.  void when they
+ * cannot be determined (generic lambdas, overloaded methods, emitters).
+ */
+template<typename Stage>
+class stage_args {
+  private:
+    template<typename S> static typename member_args<decltype(&S::callable_type::operator())>::type *test(rank<3>);
+    template<typename S> static typename member_args<decltype(&S::filter)>::type *test(rank<2>);
+    template<typename S> static typename member_args<decltype(&S::map)>::type *test(rank<1>);
+    template<typename> static void *test(rank<0>);
+
+  public:
+    typedef std::remove_pointer_t<decltype(test<Stage>(rank<3>()))> type;
+};
+
+template<typename Args, std::size_t I, bool Known = !std::is_void<Args>::value>
+struct arg_is_unused : std::false_type {};
+
+template<typename Args, std::size_t I>
+struct arg_is_unused<Args, I, true> : std::integral_constant<bool, (I < std::tuple_size<Args>::value) &&
+                                                                   std::is_same<typename std::tuple_element<(I < std::tuple_size<Args>::value ? I : 0), Args>::type, ROOT::unused>::value> {};
+
+template<typename Stage>
+struct is_filter_stage : std::is_base_of<TTreeProcessorFilterBase, std::decay_t<Stage>> {};
+
+/**
+ * The number of filters at the head of a chain.
+ */
+template<typename... ProcessingStages>
+struct leading_filter_count : std::integral_constant<unsigned int, 0> {};
+
+template<typename F, typename... ProcessingStages>
+struct leading_filter_count<F, ProcessingStages...> : std::integral_constant<unsigned int, is_filter_stage<F>::value ? 1 + leading_filter_count<ProcessingStages...>::value : 0> {};
+
+/**
+ * Whether any of the filters at the head of a chain looks at input I.
+ */
+template<std::size_t I, typename... ProcessingStages>
+struct leading_filters_read : std::false_type {};
+
+template<std::size_t I, typename F, typename... ProcessingStages>
+struct leading_filters_read<I, F, ProcessingStages...> : std::integral_constant<bool, is_filter_stage<F>::value &&
+    (!arg_is_unused<typename stage_args<std::decay_t<F>>::type, I>::value || leading_filters_read<I, ProcessingStages...>::value)> {};
+
+template<typename Mask>
+struct any_of : std::false_type {};
+
+template<bool B, bool... Rest>
+struct any_of<std::integer_sequence<bool, B, Rest...>> : std::integral_constant<bool, B || any_of<std::integer_sequence<bool, Rest...>>::value> {};
+
+/**
+ * Split the branches into those the leading filters need (`early`) and the
+ * rest (`late`), as std::integer_sequence<bool, ...> masks.  `deferred` is
+ * set if there is a leading filter and at least one branch can wait for it.
+ */
+template<typename BranchTypes, typename... ProcessingStages>
+class late_materialization {
+  private:
+    template<std::size_t... I>
+    static std::integer_sequence<bool, leading_filters_read<I, ProcessingStages...>::value...> early_helper(std::index_sequence<I...>);
+
+    template<std::size_t... I>
+    static std::integer_sequence<bool, !leading_filters_read<I, ProcessingStages...>::value...> late_helper(std::index_sequence<I...>);
+
+  public:
+    typedef decltype(early_helper(std::make_index_sequence<std::tuple_size<BranchTypes>::value>())) early;
+    typedef decltype(late_helper(std::make_index_sequence<std::tuple_size<BranchTypes>::value>())) late;
+    static const unsigned int filter_count = leading_filter_count<ProcessingStages...>::value;
+    static const bool deferred = filter_count && any_of<late>::value;
+};
+
+/**
+ * Whether the chain looks at input I: a stage consumes its inputs unless it
+ * declares them ROOT::unused, and filters also hand them to the next stage.
+ */
+template<std::size_t I, typename... ProcessingStages>
+struct chain_reads : std::false_type {};
+
+template<std::size_t I, typename F, typename... ProcessingStages>
+struct chain_reads<I, F, ProcessingStages...> : std::integral_constant<bool, !arg_is_unused<typename stage_args<std::decay_t<F>>::type, I>::value ||
+    (is_filter_stage<F>::value && chain_reads<I, ProcessingStages...>::value)> {};
+
+/**
+ * The branches read by a chain, as a std::integer_sequence<bool, ...>.
+ * Unread branches are pruned: they get no TTreeReaderValue or bulk column,
+ * and stages see a default-constructed value for them.
+ */
+template<typename BranchTypes, typename... ProcessingStages>
+class used_branches {
+  private:
+    template<std::size_t... I>
+    static std::integer_sequence<bool, (!sizeof...(ProcessingStages) || chain_reads<I, ProcessingStages...>::value)...> helper(std::index_sequence<I...>);
+
+  public:
+    typedef decltype(helper(std::make_index_sequence<std::tuple_size<BranchTypes>::value>())) type;
+};
+
+template<typename BranchTypes>
+using all_branches_t = typename used_branches<BranchTypes>::type;
+
 template<class T> using stage_initializer_t = typename std::conditional<std::is_move_constructible<T>::value, T&&, T&>::type;
 template<class T> using stage_storage_t = typename std::conditional<std::is_move_constructible<T>::value, T, T&>::type;
 
 /**
  * Given a new processor chain, call the constructor appropriately
  */
-template <class Processor, class BranchSpecType, class StagesTuple, class NewStage, std::size_t... I>
-Processor&& construct_processor_impl(const BranchSpecType &branches, StagesTuple &stages, stage_initializer_t<NewStage> new_stage, std::index_sequence<I...> )
+template <class Processor, class BranchSpecType, class StagesTuple, class... NewStages, std::size_t... I>
+Processor construct_processor_impl(const BranchSpecType &branches, StagesTuple &stages, std::index_sequence<I...>, stage_initializer_t<NewStages>... new_stages)
 {
-  return std::move(Processor(branches, std::forward<typename std::tuple_element<I, StagesTuple>::type>(std::get<I>(stages))..., std::forward<stage_initializer_t<NewStage>>(new_stage)));
+  return Processor(branches, std::forward<typename std::tuple_element<I, StagesTuple>::type>(std::get<I>(stages))..., std::forward<stage_initializer_t<NewStages>>(new_stages)...);
 }
 
-template <class Processor, class BranchSpecType, class StagesTuple, class NewStage>
-Processor&& construct_processor(const BranchSpecType &branches, StagesTuple &stages, stage_initializer_t<NewStage> new_stage)
+template <class Processor, class BranchSpecType, class StagesTuple, class... NewStages>
+Processor construct_processor(const BranchSpecType &branches, StagesTuple &stages, stage_initializer_t<NewStages>... new_stages)
 {
-    return construct_processor_impl<Processor, BranchSpecType, StagesTuple, NewStage>(branches, stages, std::move(new_stage), std::make_index_sequence<std::tuple_size<StagesTuple>::value>{});
+    return construct_processor_impl<Processor, BranchSpecType, StagesTuple, NewStages...>(branches, stages, std::make_index_sequence<std::tuple_size<StagesTuple>::value>{}, std::forward<stage_initializer_t<NewStages>>(new_stages)...);
 }
 
 
@@ -0,0 +1,232 @@
+#ifndef __INSTRUMENTATION_H_
+#define __INSTRUMENTATION_H_
+
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tbb/enumerable_thread_specific.h"
+
+#include "Rtypes.h"
+
+#include "VcHelpers.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * STAGE INSTRUMENTATION
+ *
+ * Compiled in with -DTTREEPROCESSOR_INSTRUMENT: every chain then counts,
+ * per stage and per thread, the events going into and out of each stage
+ * (active lanes on a vectorized stream) and the time spent in the stage
+ * itself, not counting the stages downstream of it.  Timing is sampled:
+ * one call in sample_period is timed with steady_clock and the stage's
+ * total is extrapolated from its number of calls.  Calls made a block at
+ * a time are always timed.  At finalize the processor prints a table of
+ * the stages, and writes the numbers as JSON to the file given to
+ * report(), if any.
+ *
+ * Without the define, probes are empty classes whose methods do nothing,
+ * and the stage recursion compiles to the same code as uninstrumented.
+ */
+#ifdef TTREEPROCESSOR_INSTRUMENT
+static const bool instrumented = true;
+#else
+static const bool instrumented = false;
+#endif
+
+// Events carried by a tuple of the stream: its active lanes if vectorized.
+template<typename T>
+inline Long64_t event_count(const T &, std::false_type) {return 1;}
+
+template<typename T>
+inline Long64_t event_count(const T &args, std::true_type) {return std::get<0>(args).count();}
+
+template<typename T>
+inline Long64_t event_count(const T &args) {return event_count(args, std::integral_constant<bool, is_vectorized_tuple<T>::value>());}
+
+// What one thread measured for one stage.
+struct TStageStats {
+    Long64_t calls{0};
+    Long64_t events_in{0};
+    Long64_t events_out{0};
+    Long64_t sampled_calls{0};
+    std::chrono::nanoseconds sampled_time{0};
+
+    void add(const TStageStats &other) {
+        calls += other.calls;
+        events_in += other.events_in;
+        events_out += other.events_out;
+        sampled_calls += other.sampled_calls;
+        sampled_time += other.sampled_time;
+    }
+
+    // Estimated time spent in the stage, in seconds.
+    double seconds() const {
+        if (!sampled_calls) {return 0;}
+        return std::chrono::duration<double>(sampled_time).count() * calls / sampled_calls;
+    }
+};
+
+template<bool Enabled>
+class TStageProbe;
+
+/**
+ * Records one call of a stage into the calling thread's TStageStats:
+ *
+ *   auto probe = ...;
+ *   probe.start(events_in);
+ *   ... run the stage ...
+ *   probe.stop(events_out);
+ *
+ * Output handed downstream through wrap(next) is counted as the stage's
+ * output, and the time spent downstream is left out of the stage's.
+ */
+template<>
+class TStageProbe<true> {
+  public:
+    static const Long64_t sample_period = 16;
+
+    explicit TStageProbe(TStageStats &stats) : m_stats(stats) {}
+
+    void start(Long64_t events, bool always = false) {
+        m_stats.events_in += events;
+        m_sampling = always || (m_stats.calls % sample_period == 0);
+        m_stats.calls++;
+        if (m_sampling) {
+            m_downstream = std::chrono::steady_clock::duration::zero();
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    void stop(Long64_t events) {
+        m_stats.events_out += events;
+        if (!m_sampling) {return;}
+        m_stats.sampled_calls++;
+        m_stats.sampled_time += std::chrono::steady_clock::now() - m_start - m_downstream;
+    }
+
+    template<typename Next>
+    auto wrap(Next next) {
+        return [this, next](const auto &args) mutable {
+            m_stats.events_out += event_count(args);
+            if (!m_sampling) {next(args); return;}
+            auto begin = std::chrono::steady_clock::now();
+            next(args);
+            m_downstream += std::chrono::steady_clock::now() - begin;
+        };
+    }
+
+  private:
+    TStageStats &m_stats;
+    bool m_sampling{false};
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_downstream{0};
+};
+
+template<>
+class TStageProbe<false> {
+  public:
+    void start(Long64_t, bool = false) {}
+    void stop(Long64_t) {}
+
+    template<typename Next>
+    Next wrap(Next next) {return next;}
+};
+
+template<bool Enabled, std::size_t Count>
+class TChainStatistics;
+
+/**
+ * The per-thread TStageStats of each of the Count stages of a chain.
+ */
+template<std::size_t Count>
+class TChainStatistics<true, Count> {
+  public:
+    typedef std::array<TStageStats, Count> thread_stats_type;
+
+    // Forget the numbers of an earlier pass.
+    void reset() {m_threads.clear();}
+
+    template<std::size_t N>
+    TStageProbe<true> probe() {return TStageProbe<true>(m_threads.local()[N]);}
+
+    /**
+     * Print a table of the stages; with a file name, also write per-stage
+     * and per-thread numbers there as JSON.  kinds and vectorized describe
+     * each stage.
+     */
+    void report(const std::array<const char*, Count> &kinds, const std::array<bool, Count> &vectorized, const std::string &fileName) const {
+        thread_stats_type total{};
+        std::vector<thread_stats_type> threads(m_threads.begin(), m_threads.end());
+        for (const auto &thread : threads) {
+            for (std::size_t idx = 0; idx < Count; idx++) {total[idx].add(thread[idx]);}
+        }
+        double seconds = 0;
+        for (const auto &stage : total) {seconds += stage.seconds();}
+
+        // Formatted apart so std::cout's flags are left alone.
+        std::ostringstream table;
+        table << "Stage  Kind          Events in   Events out   Pass %    Time (ms)   ns/event   Share %\n";
+        for (std::size_t idx = 0; idx < Count; idx++) {
+            const auto &stage = total[idx];
+            table << std::setw(5) << idx << "  "
+                  << std::left << std::setw(12) << (std::string(kinds[idx]) + (vectorized[idx] ? " [v]" : "")) << std::right
+                  << std::setw(11) << stage.events_in << std::setw(13) << stage.events_out
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(9) << (stage.events_in ? 100.0 * stage.events_out / stage.events_in : 0.)
+                  << std::setprecision(3) << std::setw(13) << 1e3 * stage.seconds()
+                  << std::setprecision(1) << std::setw(11) << (stage.events_in ? 1e9 * stage.seconds() / stage.events_in : 0.)
+                  << std::setw(10) << (seconds ? 100.0 * stage.seconds() / seconds : 0.) << "\n";
+        }
+        std::cout << table.str();
+        if (fileName.empty()) {return;}
+
+        std::ofstream out(fileName);
+        out << "{\"stages\": [";
+        for (std::size_t idx = 0; idx < Count; idx++) {
+            out << (idx ? ", " : "") << "{\"index\": " << idx << ", \"kind\": \"" << kinds[idx] << "\", \"vectorized\": " << (vectorized[idx] ? "true" : "false") << ", ";
+            write_stats(out, total[idx]);
+            out << ", \"threads\": [";
+            for (std::size_t thread = 0; thread < threads.size(); thread++) {
+                out << (thread ? ", " : "") << "{";
+                write_stats(out, threads[thread][idx]);
+                out << "}";
+            }
+            out << "]}";
+        }
+        out << "]}\n";
+    }
+
+  private:
+    static void write_stats(std::ostream &out, const TStageStats &stats) {
+        out << "\"calls\": " << stats.calls << ", \"events_in\": " << stats.events_in << ", \"events_out\": " << stats.events_out
+            << ", \"sampled_calls\": " << stats.sampled_calls << ", \"seconds\": " << stats.seconds();
+    }
+
+    tbb::enumerable_thread_specific<thread_stats_type> m_threads;
+};
+
+template<std::size_t Count>
+class TChainStatistics<false, Count> {
+  public:
+    void reset() {}
+
+    template<std::size_t N>
+    TStageProbe<false> probe() {return TStageProbe<false>();}
+
+    void report(const std::array<const char*, Count> &, const std::array<bool, Count> &, const std::string &) const {}
+};
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __INSTRUMENTATION_H_
@@ -0,0 +1,168 @@
+#ifndef __JAGGED_H_
+#define __JAGGED_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <Vc/Allocator>
+
+#include "VcHelpers.h"
+
+namespace ROOT {
+
+/**
+ * VARIABLE-LENGTH BRANCHES
+ *
+ * A branch declared as span<T> in the processor's BranchTypes holds a
+ * per-event collection of T (an array, std::vector<T> or a member of a
+ * split TClonesArray such as fTracks.fPx).  Stages receive a lightweight
+ * view of the event's elements; the elements themselves live in buffers
+ * owned by the processor, which are reused from one event to the next.
+ * A stage that keeps elements past the event (e.g. an emitter buffering
+ * its input) must copy them.
+ */
+template<typename T>
+class span {
+  public:
+    typedef T value_type;
+
+    span() {}
+    span(const T *data, std::size_t size) : m_data(data), m_size(size) {}
+
+    const T *data() const {return m_data;}
+    std::size_t size() const {return m_size;}
+    bool empty() const {return !m_size;}
+
+    const T &operator[](std::size_t idx) const {return m_data[idx];}
+    const T *begin() const {return m_data;}
+    const T *end() const {return m_data + m_size;}
+
+    /**
+     * Elements [idx, idx+vector_count) as a vector.  The storage behind
+     * the spans handed out by the processor is padded, so this may run past
+     * the end of the span; lanes outside it hold unspecified values and
+     * are switched off in mask(idx).
+     */
+    internal::vector_t<T> vector(std::size_t idx) const {return internal::vector_t<T>(m_data + idx, Vc::Unaligned);}
+
+    maskv mask(std::size_t idx) const {return floatv::IndexesFromZero() < floatv(static_cast<float>(m_size - idx));}
+
+  private:
+    const T *m_data{nullptr};
+    std::size_t m_size{0};
+};
+
+/**
+ * The collections of several events flattened into one contiguous,
+ * aligned array of values plus an offsets array: row i holds the values
+ * [offsets()[i], offsets()[i+1]).  Block mode (TTreeProcessor::blocks)
+ * stores span<T> columns this way, so the elements of a whole block sit
+ * next to each other and a row costs no allocation.
+ *
+ * The values are padded by vector_count elements so vector loads may run
+ * past the last row.
+ */
+template<typename T>
+class TJaggedArray {
+  public:
+    TJaggedArray() : m_offsets(1, 0) {}
+
+    // Number of rows.
+    std::size_t size() const {return m_offsets.size() - 1;}
+
+    // Number of values over all rows.
+    std::size_t count() const {return m_offsets.back();}
+
+    const T *values() const {return m_values.data();}
+    T *values() {return m_values.data();}
+    const std::vector<std::size_t> &offsets() const {return m_offsets;}
+
+    span<T> operator[](std::size_t row) const {
+        return span<T>(m_values.data() + m_offsets[row], m_offsets[row+1] - m_offsets[row]);
+    }
+
+    void clear() {m_offsets.resize(1);}
+
+    /**
+     * Truncate to the first rows, or append empty rows up to rows.
+     */
+    void resize(std::size_t rows) {m_offsets.resize(rows + 1, count());}
+
+    void push_back(const T *data, std::size_t size) {
+        std::size_t start = count();
+        reserve_values(start + size);
+        std::copy(data, data + size, m_values.begin() + start);
+        m_offsets.push_back(start + size);
+    }
+
+    void push_back(span<T> row) {push_back(row.data(), row.size());}
+
+    /**
+     * Set row `row`, dropping any rows after it; rows are written in
+     * increasing order, and skipped rows are left empty.
+     */
+    void set(std::size_t row, span<T> value) {
+        resize(row);
+        push_back(value);
+    }
+
+    /**
+     * Give the array the same rows as other, with count() values each
+     * left to be written through values().
+     */
+    template<typename U>
+    void reshape(const TJaggedArray<U> &other) {
+        m_offsets = other.offsets();
+        reserve_values(count());
+    }
+
+  private:
+    // Storage only ever grows, so a block's array is allocated once.
+    void reserve_values(std::size_t size) {
+        if (m_values.size() < size + vector_count) {m_values.resize(2*size + vector_count);}
+    }
+
+    std::vector<T, Vc::Allocator<T>> m_values;
+    std::vector<std::size_t> m_offsets;
+};
+
+/**
+ * Apply a vectorized kernel to every value of one or more jagged arrays
+ * with identical rows (e.g. the px and py of all tracks in a block),
+ * vector_count values at a time regardless of row boundaries:
+ *
+ *   flat_transform(pt, [](floatv px, floatv py) {return Vc::sqrt(px*px + py*py);}, px, py);
+ *
+ * out gets the rows of the first input.
+ */
+template<typename R, typename F, typename T, typename... U>
+void
+flat_transform(TJaggedArray<R> &out, F &&fn, const TJaggedArray<T> &first, const TJaggedArray<U> &... rest) {
+    out.reshape(first);
+    for (std::size_t idx = 0; idx < first.count(); idx += vector_count) {
+        internal::vector_t<R> result = fn(internal::vector_t<T>(first.values() + idx, Vc::Aligned), internal::vector_t<U>(rest.values() + idx, Vc::Aligned)...);
+        result.store(out.values() + idx, Vc::Aligned);
+    }
+}
+
+/**
+ * Reduce each row of a jagged array to a single value:
+ * out[row] = fn(...fn(fn(init, v0), v1)..., vn).
+ */
+template<typename R, typename F, typename T>
+void
+segment_reduce(std::vector<R> &out, const TJaggedArray<T> &in, R init, F &&fn) {
+    out.resize(in.size());
+    const T *values = in.values();
+    for (std::size_t row = 0; row < in.size(); row++) {
+        R acc = init;
+        for (std::size_t idx = in.offsets()[row]; idx < in.offsets()[row+1]; idx++) {
+            acc = fn(acc, values[idx]);
+        }
+        out[row] = acc;
+    }
+}
+
+}  // namespace ROOT
+
+#endif  // __JAGGED_H_
@@ -30,15 +30,212 @@ struct generate_lambda_helper_vectorized<I, I, 1, LambdaClass, T, InputTuple, Ar
     typedef LambdaClass<1, T, maskv, Args...> type;
 };
 
+// The input is already a vectorized tuple (mask first); pass the types through unchanged.
+template<unsigned int I, unsigned int J, template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, typename InputTuple, typename... Args>
+struct generate_lambda_helper_vectorized<I, J, 2, LambdaClass, T, InputTuple, Args...> {
+    typedef typename generate_lambda_helper_vectorized<I+1, J, 2, LambdaClass, T, InputTuple, Args..., typename std::tuple_element<I, InputTuple>::type>::type type;
+};
+
+template<unsigned int I, template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, typename InputTuple, typename... Args>
+struct generate_lambda_helper_vectorized<I, I, 2, LambdaClass, T, InputTuple, Args...> {
+    typedef LambdaClass<1, T, Args...> type;
+};
+
 template<template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, class InputTuple>
 class generate_lambda_type_vectorized {
   private:
     static const int type_count = std::tuple_size<InputTuple>::value;
     static const bool is_vectorized = internal::is_vectorized<T, InputTuple>::value;
-    //static const bool is_vectorized = 1;
+    static const unsigned int mode = internal::is_vectorized_tuple<InputTuple>::value ? 2 : is_vectorized;
+
+  public:
+    typedef typename generate_lambda_helper_vectorized<0, type_count, mode, LambdaClass, T, InputTuple>::type type;
+};
+
+// Adapter and terminal stages, defined in internal/GeneratedKernels.h
+template<typename InputTuple> struct packer_type;
+template<typename InputTuple> struct unpacker_type;
+template<unsigned int IsVectorized, typename T, typename Combine, typename InputTuple> struct reducer_type;
+template<typename Acc, typename InputTuple> struct aggregator_type;
+template<typename Output, typename T, typename InputTuple> struct flat_mapper_type;
+template<typename InputTuple> struct snapshot_type;
+template<typename InputTuple> struct collector_type;
+
+/**
+ * Determine the stage(s) generated for a lambda appended to a stream of
+ * InputTuple.
+ *
+ * A lambda stays in the stream's current mode (scalar or vectorized) when it
+ * can be called that way.  Otherwise, an adapter stage switching modes is
+ * placed in front of it: a packer when a vectorized lambda follows a scalar
+ * stage, an unpacker when a scalar-only lambda follows a vectorized stage.
+ * The first stage never needs an adapter, as the reader produces whichever
+ * form that stage wants.
+ *
+ * `type` is a std::tuple of the stages to append; `make` constructs them.
+ */
+template<template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, class InputTuple, bool IsFirst,
+         bool IsVectorizedInput = is_vectorized_tuple<InputTuple>::value>
+struct generate_lambda_stages;
+
+// Scalar stream.
+template<template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, class InputTuple, bool IsFirst>
+struct generate_lambda_stages<LambdaClass, T, InputTuple, IsFirst, false> {
+  private:
+    static const int type_count = std::tuple_size<InputTuple>::value;
+    static const bool needs_packer = !IsFirst && !is_callable_with_tuple<T, InputTuple>::value && is_vectorized<T, InputTuple>::value;
+    static const unsigned int mode = IsFirst ? is_vectorized<T, InputTuple>::value : needs_packer;
+    typedef typename generate_lambda_helper_vectorized<0, type_count, mode, LambdaClass, T, InputTuple>::type lambda_type;
+    typedef typename packer_type<InputTuple>::type adapter_type;
+
+    static std::tuple<lambda_type> make_helper(const T &fn, std::false_type) {return std::tuple<lambda_type>(lambda_type(fn));}
+    static std::tuple<adapter_type, lambda_type> make_helper(const T &fn, std::true_type) {return std::tuple<adapter_type, lambda_type>(adapter_type(), lambda_type(fn));}
+
+  public:
+    typedef decltype(make_helper(std::declval<const T&>(), std::integral_constant<bool, needs_packer>())) type;
+
+    static type make(const T &fn) {return make_helper(fn, std::integral_constant<bool, needs_packer>());}
+};
+
+// Vectorized stream.
+template<template<unsigned int IsVectorized, typename T, typename... Args> class LambdaClass, typename T, class InputTuple, bool IsFirst>
+struct generate_lambda_stages<LambdaClass, T, InputTuple, IsFirst, true> {
+  private:
+    static const bool needs_unpacker = !is_callable_with_tuple<T, InputTuple>::value && is_callable_with_tuple<T, scalar_tuple_t<InputTuple>>::value;
+    typedef typename std::conditional<needs_unpacker, scalar_tuple_t<InputTuple>, InputTuple>::type lambda_input;
+    typedef typename generate_lambda_helper_vectorized<0, std::tuple_size<lambda_input>::value, needs_unpacker ? 0 : 2, LambdaClass, T, lambda_input>::type lambda_type;
+    typedef typename unpacker_type<InputTuple>::type adapter_type;
+
+    static std::tuple<lambda_type> make_helper(const T &fn, std::false_type) {return std::tuple<lambda_type>(lambda_type(fn));}
+    static std::tuple<adapter_type, lambda_type> make_helper(const T &fn, std::true_type) {return std::tuple<adapter_type, lambda_type>(adapter_type(), lambda_type(fn));}
+
+  public:
+    typedef decltype(make_helper(std::declval<const T&>(), std::integral_constant<bool, needs_unpacker>())) type;
+
+    static type make(const T &fn) {return make_helper(fn, std::integral_constant<bool, needs_unpacker>());}
+};
+
+/**
+ * Determine the stage(s) generated for reduce(init, combine) on a stream of
+ * InputTuple.  A vectorized stream is reduced lane-wise if combine accepts
+ * the vector types (and scalars, to combine the lanes at the end);
+ * otherwise it is unpacked first.
+ */
+template<typename T, typename Combine, class InputTuple, bool IsVectorizedInput = is_vectorized_tuple<InputTuple>::value>
+struct generate_reducer_stages;
+
+template<typename T, typename Combine, class InputTuple>
+struct generate_reducer_stages<T, Combine, InputTuple, false> {
+    typedef std::tuple<typename reducer_type<0, T, Combine, InputTuple>::type> type;
+
+    static type make(const T &init, const Combine &combine) {return type(typename reducer_type<0, T, Combine, InputTuple>::type(init, combine));}
+};
+
+template<typename T, typename Combine, typename... VArgs>
+struct generate_reducer_stages<T, Combine, std::tuple<maskv, VArgs...>, true> {
+  private:
+    typedef std::tuple<maskv, VArgs...> InputTuple;
+    static const bool needs_unpacker = !is_callable_with_tuple<Combine, std::tuple<vector_t<T>, VArgs...>>::value ||
+                                       !is_callable_with_tuple<Combine, std::tuple<T, T>>::value;
+    typedef typename std::conditional<needs_unpacker, scalar_tuple_t<InputTuple>, InputTuple>::type reducer_input;
+    typedef typename reducer_type<!needs_unpacker, T, Combine, reducer_input>::type reducer_stage;
+    typedef typename unpacker_type<InputTuple>::type adapter_type;
+
+    static std::tuple<reducer_stage> make_helper(const T &init, const Combine &combine, std::false_type) {return std::tuple<reducer_stage>(reducer_stage(init, combine));}
+    static std::tuple<adapter_type, reducer_stage> make_helper(const T &init, const Combine &combine, std::true_type) {return std::tuple<adapter_type, reducer_stage>(adapter_type(), reducer_stage(init, combine));}
+
+  public:
+    typedef decltype(make_helper(std::declval<const T&>(), std::declval<const Combine&>(), std::integral_constant<bool, needs_unpacker>())) type;
+
+    static type make(const T &init, const Combine &combine) {return make_helper(init, combine, std::integral_constant<bool, needs_unpacker>());}
+};
+
+/**
+ * Determine the stage(s) generated for aggregate(acc) on a stream of
+ * InputTuple; as for reduce, a vectorized stream is unpacked if the
+ * accumulator only takes scalars.
+ */
+template<typename Acc, class InputTuple, bool IsVectorizedInput = is_vectorized_tuple<InputTuple>::value>
+struct generate_aggregator_stages;
+
+template<typename Acc, class InputTuple>
+struct generate_aggregator_stages<Acc, InputTuple, false> {
+    typedef std::tuple<typename aggregator_type<Acc, InputTuple>::type> type;
+
+    static type make(const Acc &acc) {return type(typename aggregator_type<Acc, InputTuple>::type(acc));}
+};
+
+template<typename Acc, class InputTuple>
+struct generate_aggregator_stages<Acc, InputTuple, true> {
+  private:
+    static const bool needs_unpacker = !is_callable_with_tuple<Acc, InputTuple>::value;
+    typedef typename std::conditional<needs_unpacker, scalar_tuple_t<InputTuple>, InputTuple>::type aggregator_input;
+    typedef typename aggregator_type<Acc, aggregator_input>::type aggregator_stage;
+    typedef typename unpacker_type<InputTuple>::type adapter_type;
+
+    static std::tuple<aggregator_stage> make_helper(const Acc &acc, std::false_type) {return std::tuple<aggregator_stage>(aggregator_stage(acc));}
+    static std::tuple<adapter_type, aggregator_stage> make_helper(const Acc &acc, std::true_type) {return std::tuple<adapter_type, aggregator_stage>(adapter_type(), aggregator_stage(acc));}
 
   public:
-    typedef typename generate_lambda_helper_vectorized<0, type_count, is_vectorized, LambdaClass, T, InputTuple>::type type;
+    typedef decltype(make_helper(std::declval<const Acc&>(), std::integral_constant<bool, needs_unpacker>())) type;
+
+    static type make(const Acc &acc) {return make_helper(acc, std::integral_constant<bool, needs_unpacker>());}
+};
+
+/**
+ * Determine the stage(s) generated for flatMap<Output>(fn) on a stream of
+ * InputTuple.  The lambda is always called on scalars: a vectorized stream
+ * is unpacked first.  Its output is a scalar stream, which later
+ * vectorized stages receive packed into full vectors.
+ */
+template<typename Output, typename T, class InputTuple, bool IsVectorizedInput = is_vectorized_tuple<InputTuple>::value>
+struct generate_flat_map_stages;
+
+template<typename Output, typename T, class InputTuple>
+struct generate_flat_map_stages<Output, T, InputTuple, false> {
+    typedef std::tuple<typename flat_mapper_type<Output, T, InputTuple>::type> type;
+
+    static type make(const T &fn) {return type(typename flat_mapper_type<Output, T, InputTuple>::type(fn));}
+};
+
+template<typename Output, typename T, class InputTuple>
+struct generate_flat_map_stages<Output, T, InputTuple, true> {
+  private:
+    typedef typename flat_mapper_type<Output, T, scalar_tuple_t<InputTuple>>::type flat_mapper_stage;
+    typedef typename unpacker_type<InputTuple>::type adapter_type;
+
+  public:
+    typedef std::tuple<adapter_type, flat_mapper_stage> type;
+
+    static type make(const T &fn) {return type(adapter_type(), flat_mapper_stage(fn));}
+};
+
+/**
+ * Determine the stage(s) generated for a terminal that takes one event at
+ * a time (snapshot(), collect()) on a stream of InputTuple: a vectorized
+ * stream is unpacked first.  StageType<Tuple>::type is the terminal for a
+ * scalar stream of Tuple.
+ */
+template<template<typename> class StageType, class InputTuple, bool IsVectorizedInput = is_vectorized_tuple<InputTuple>::value>
+struct generate_scalar_terminal_stages;
+
+template<template<typename> class StageType, class InputTuple>
+struct generate_scalar_terminal_stages<StageType, InputTuple, false> {
+    typedef typename StageType<InputTuple>::type terminal_stage;
+    typedef std::tuple<terminal_stage> type;
+
+    template<typename... Args>
+    static type make(Args &&... args) {return type(terminal_stage(std::forward<Args>(args)...));}
+};
+
+template<template<typename> class StageType, class InputTuple>
+struct generate_scalar_terminal_stages<StageType, InputTuple, true> {
+    typedef typename StageType<scalar_tuple_t<InputTuple>>::type terminal_stage;
+    typedef typename unpacker_type<InputTuple>::type adapter_type;
+    typedef std::tuple<adapter_type, terminal_stage> type;
+
+    template<typename... Args>
+    static type make(Args &&... args) {return type(adapter_type(), terminal_stage(std::forward<Args>(args)...));}
 };
 
 }  // internal
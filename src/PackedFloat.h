@@ -0,0 +1,128 @@
+#ifndef __PACKED_FLOAT_H_
+#define __PACKED_FLOAT_H_
+
+#include <algorithm>
+#include <cstring>
+
+#include "Bytes.h"
+#include "TStreamerElement.h"
+
+#include "VcHelpers.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * TRUNCATED FLOATING POINT
+ *
+ * Float16_t and Double32_t are plain float and double in memory, but are
+ * written in one of three reduced-precision encodings, chosen by the range
+ * spec in the member's comment or the leaf's title:
+ *
+ *  - "[xmin,xmax,nbits]" with xmin < xmax: an integer of nbits bits, stored
+ *    as a UInt_t, scaled into [xmin, xmax];
+ *  - "[0,0,nbits]", or no spec at all for a Float16_t (nbits = 12): a float
+ *    with its mantissa cut to nbits bits, stored as a one-byte exponent and
+ *    a two-byte mantissa carrying the sign in bit nbits+1;
+ *  - no spec for a Double32_t: a float.
+ *
+ * decode() turns a run of serialized values into floats or doubles
+ * vector_count at a time: the bytes of each lane are gathered, then the
+ * scaling or the reassembly of the IEEE-754 bits is done on whole vectors.
+ * Results are identical to TBufferFile::ReadFloat16 / ReadDouble32.
+ */
+class TPackedFloat {
+  public:
+    enum Encoding {kNone, kFloat, kRange, kTruncated};
+
+    TPackedFloat() {}
+
+    /**
+     * The encoding of a Float16_t (isFloat16) or Double32_t described by
+     * element; element may be null when there is no range spec.
+     */
+    TPackedFloat(const TStreamerElement *element, bool isFloat16) {
+      if (element && element->GetFactor() != 0) {
+        m_encoding = kRange;
+        m_factor = element->GetFactor();
+        m_xmin = element->GetXmin();
+        return;
+      }
+      // Without a factor, xmin holds the number of mantissa bits (if any).
+      m_nbits = element ? static_cast<int>(element->GetXmin()) : 0;
+      if (!m_nbits && isFloat16) {m_nbits = 12;}
+      m_encoding = m_nbits ? kTruncated : kFloat;
+    }
+
+    // False for branches that are not Float16_t or Double32_t.
+    bool packed() const {return m_encoding != kNone;}
+
+    Encoding encoding() const {return m_encoding;}
+
+    // Bytes per serialized value.
+    std::size_t width() const {return m_encoding == kTruncated ? 3 : 4;}
+
+    /**
+     * Decode count values from the serialized (big-endian) bytes at src.
+     */
+    template<typename T>
+    void decode(const char *src, T *dest, Long64_t count) const {
+      for (Long64_t idx = 0; idx < count; idx += vector_count) {
+          std::size_t lanes = std::min<Long64_t>(vector_count, count - idx);
+          vector_t<T> values = Vc::simd_cast<vector_t<T>>(decode_vector(src, lanes));
+          if (lanes == vector_count) {
+            values.store(dest + idx, Vc::Unaligned);
+          } else {
+            T tail[vector_count];
+            values.store(tail, Vc::Unaligned);
+            std::copy(tail, tail + lanes, dest + idx);
+          }
+          src += lanes * width();
+      }
+    }
+
+  private:
+    // Decode up to vector_count values; the lanes past `lanes` are zero.
+    doublev decode_vector(const char *src, std::size_t lanes) const {
+      char *cur = const_cast<char*>(src);
+      if (m_encoding == kRange) {
+        UInt_t raw[vector_count] = {};
+        for (std::size_t lane = 0; lane < lanes; lane++) {frombuf(cur, raw + lane);}
+        return Vc::simd_cast<doublev>(uintv(raw, Vc::Unaligned)) / doublev(m_factor) + doublev(m_xmin);
+      }
+      Float_t values[vector_count] = {};
+      if (m_encoding == kFloat) {
+        for (std::size_t lane = 0; lane < lanes; lane++) {frombuf(cur, values + lane);}
+        return Vc::simd_cast<doublev>(floatv(values, Vc::Unaligned));
+      }
+      UInt_t exponents[vector_count] = {}, mantissas[vector_count] = {};
+      for (std::size_t lane = 0; lane < lanes; lane++) {
+          UChar_t exponent;
+          UShort_t mantissa;
+          frombuf(cur, &exponent);
+          frombuf(cur, &mantissa);
+          exponents[lane] = exponent;
+          mantissas[lane] = mantissa;
+      }
+      uintv mantissa(mantissas, Vc::Unaligned);
+      uintv bits = (uintv(exponents, Vc::Unaligned) << 23) |
+                   ((mantissa & uintv((1u << (m_nbits + 1)) - 1)) << (23 - m_nbits)) |
+                   (((mantissa >> (m_nbits + 1)) & uintv(1u)) << 31);
+      UInt_t words[vector_count];
+      bits.store(words, Vc::Unaligned);
+      std::memcpy(values, words, sizeof(values));
+      return Vc::simd_cast<doublev>(floatv(values, Vc::Unaligned));
+    }
+
+    Encoding m_encoding{kNone};
+    int m_nbits{0};
+    double m_factor{0};
+    double m_xmin{0};
+};
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __PACKED_FLOAT_H_
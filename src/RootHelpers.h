@@ -1,38 +1,131 @@
+#ifndef __ROOT_HELPERS_H_
+#define __ROOT_HELPERS_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <vector>
 
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+
+#include <Vc/Allocator>
+
+#include "Bytes.h"
+#include "ColumnCache.h"
+#include "TBranch.h"
+#include "TBranchElement.h"
+#include "TBufferFile.h"
 #include "TFile.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TStreamerInfo.h"
 #include "TTreeReader.h"
+#include "TTreeReaderArray.h"
+#include "TVirtualStreamerInfo.h"
 
 #include "VcHelpers.h"
 #include "Helpers.h"
+#include "Jagged.h"
+#include "PackedFloat.h"
+#include "TaskTrace.h"
 
 namespace ROOT {
 
 namespace internal {
 
+/**
+ * Reads a variable-length branch through a TTreeReaderArray and hands out
+ * each event's elements as a span.  The elements are copied (members of a
+ * TClonesArray are not contiguous in memory) into one of vector_count
+ * buffers used in turn, so the spans of the events packed into a single
+ * vectorized tuple stay valid together.
+ */
+template<typename T>
+class TSpanReader {
+  public:
+    typedef span<T> NonConstT_t;
+
+    TSpanReader(TTreeReader &reader, const char *name) : m_array(reader, name) {}
+
+    span<T> get() {
+        auto &buffer = m_buffers[m_next];
+        m_next = (m_next + 1) % vector_count;
+        std::size_t size = m_array.GetSize();
+        // Padded so that span::vector() may load past the last element.
+        if (buffer.size() < size + vector_count) {buffer.resize(2*size + vector_count);}
+        for (std::size_t idx = 0; idx < size; idx++) {buffer[idx] = m_array[idx];}
+        return span<T>(buffer.data(), size);
+    }
+
+  private:
+    TTreeReaderArray<T> m_array;
+    std::array<std::vector<T, Vc::Allocator<T>>, vector_count> m_buffers;
+    std::size_t m_next{0};
+};
+
+// The reader object for a branch of type T.
+template<typename T>
+struct reader_value_type {
+    typedef TTreeReaderValue<T> type;
+};
+
+template<typename T>
+struct reader_value_type<span<T>> {
+    typedef TSpanReader<T> type;
+};
+
 template<typename BranchTypes, std::size_t... I>
 struct reader_tuple_type {
-    typedef std::tuple<std::shared_ptr<TTreeReaderValue<typename std::tuple_element<I, BranchTypes>::type>> ...> type;
+    typedef std::tuple<std::shared_ptr<typename reader_value_type<typename std::tuple_element<I, BranchTypes>::type>::type> ...> type;
 };
 
-template<typename BranchTypes, std::size_t... I>
+// Pruned branches get no TTreeReaderValue, so the reader never loads them.
+template<typename T, bool Used>
+struct make_reader_value {
+    static std::shared_ptr<typename reader_value_type<T>::type> make(TTreeReader &reader, const std::string &name) {
+        return std::make_shared<typename reader_value_type<T>::type>(reader, name.c_str());
+    }
+};
+
+template<typename T>
+struct make_reader_value<T, false> {
+    static std::shared_ptr<typename reader_value_type<T>::type> make(TTreeReader &, const std::string &) {return nullptr;}
+};
+
+template<typename BranchTypes, bool... Used, std::size_t... I>
 typename reader_tuple_type<BranchTypes, I...>::type
-make_reader_tuple_helper(TTreeReader &reader, typename internal::convert_to_strings<BranchTypes>::type &branch_names, std::index_sequence<I...>) {
-    return std::make_tuple(std::make_shared<TTreeReaderValue<typename std::tuple_element<I, BranchTypes>::type>>(reader, std::get<I>(branch_names).c_str()) ...);
+make_reader_tuple_helper(TTreeReader &reader, typename internal::convert_to_strings<BranchTypes>::type &branch_names, std::integer_sequence<bool, Used...>, std::index_sequence<I...>) {
+    return std::make_tuple(make_reader_value<typename std::tuple_element<I, BranchTypes>::type, Used>::make(reader, std::get<I>(branch_names)) ...);
 }
 
-template<typename BranchTypes>
+template<typename BranchTypes, typename Used = all_branches_t<BranchTypes>>
 auto
 make_reader_tuple(TTreeReader &reader, typename internal::convert_to_strings<BranchTypes>::type &branch_names) {
-    return make_reader_tuple_helper<BranchTypes>(reader, branch_names, std::make_index_sequence< std::tuple_size<BranchTypes>::value >());
+    return make_reader_tuple_helper<BranchTypes>(reader, branch_names, Used(), std::make_index_sequence< std::tuple_size<BranchTypes>::value >());
+}
+
+// The value of a branch for the current entry; default-constructed if the
+// branch was pruned.
+template<typename T>
+T
+read_value(const std::shared_ptr<TTreeReaderValue<T>> &reader) {
+    return reader ? **reader : T();
+}
+
+template<typename T>
+span<T>
+read_value(const std::shared_ptr<TSpanReader<T>> &reader) {
+    return reader ? reader->get() : span<T>();
 }
 
 // Read a single-event at a time; non-vectorized mode.
 template<typename BranchTypes, typename ReaderType, std::size_t... I>
 BranchTypes
 read_event_data_helper(ReaderType& readers, std::index_sequence<I...>) {
-    return std::make_tuple(*(*std::get<I>(readers))...);
+    return std::make_tuple(read_value(std::get<I>(readers))...);
 }
 
 template<unsigned int IsVectorized, typename BranchTypes, typename ReaderType, typename ReaderValueType>
@@ -47,17 +140,40 @@ class read_event_data<0, BranchTypes, ReaderType, ReaderValueType> {
     }
 };
 
-template<typename LHS, typename RHS>
-bool param_pack_assign (LHS &lhs, const RHS &rhs)
-{
-  lhs = rhs;
-  return false;
+/**
+ * Read only the branches selected by Mask, a std::integer_sequence<bool, ...>,
+ * into an existing tuple.  The other TTreeReaderValues are not dereferenced,
+ * so their baskets are neither read nor decompressed.
+ */
+template<bool Selected>
+struct read_branch_if {
+    template<typename LHS, typename ReaderValue>
+    static bool apply(LHS &lhs, ReaderValue &reader) {lhs = read_value(reader); return false;}
+};
+
+template<>
+struct read_branch_if<false> {
+    template<typename LHS, typename ReaderValue>
+    static bool apply(LHS &, ReaderValue &) {return false;}
+};
+
+template<typename BranchTypes, typename ReaderValueType, bool... Selected, std::size_t... I>
+void
+read_event_branches_helper(BranchTypes &data, ReaderValueType &readers, std::integer_sequence<bool, Selected...>, std::index_sequence<I...>) {
+    bool ignore_array[] = {false, read_branch_if<Selected>::apply(std::get<I>(data), std::get<I>(readers))...};
+    (void)ignore_array;
+}
+
+template<typename Mask, typename BranchTypes, typename ReaderValueType>
+void
+read_event_branches(BranchTypes &data, ReaderValueType &readers) {
+    read_event_branches_helper(data, readers, Mask(), std::make_index_sequence<std::tuple_size<BranchTypes>::value>());
 }
 
 template<typename LHS, typename RHS>
-bool param_pack_load (LHS &lhs, const RHS &rhs)
+bool param_pack_assign (LHS &lhs, const RHS &rhs)
 {
-  lhs.load(rhs);
+  lhs = rhs;
   return false;
 }
 
@@ -68,15 +184,17 @@ read_event_data_vectorized_helper(ReaderType& reader, ReaderValueType& readerVal
 {
     int idx;
 
+    // Values are gathered as the vectors' lane type, which may be wider
+    // than the branch type (e.g. UChar_t lanes are 16 bits).
     std::tuple<std::array<bool, vector_count>,
-               std::array<typename std::tuple_element<I, ReaderValueType>::type::element_type::NonConstT_t, vector_count>...
+               std::array<typename vector_lanes<vector_t<typename std::tuple_element<I, ReaderValueType>::type::element_type::NonConstT_t>>::type, vector_count>...
               > dataPrep;
     auto &maskPrep = std::get<0>(dataPrep);
     // Initialize the event data from the TTreeReader.
     bool isValid = true;
     for (idx=0; idx<vector_count && isValid; idx++) {
         maskPrep[idx] = 1;
-        bool ignore_array[] = { param_pack_assign(std::get<I+1>(dataPrep)[idx], *(*std::get<I>(readerValues)))... };
+        bool ignore_array[] = { param_pack_assign(std::get<I+1>(dataPrep)[idx], read_value(std::get<I>(readerValues)))... };
         (void) ignore_array;
         isValid = (idx+1<vector_count) && reader.Next();
     }
@@ -89,7 +207,7 @@ read_event_data_vectorized_helper(ReaderType& reader, ReaderValueType& readerVal
     // Initialize the vectorized tuple from the std::arrays.
     std::tuple<maskv, vector_t<typename std::tuple_element<I, ReaderValueType>::type::element_type::NonConstT_t>...> data;
     std::get<0>(data).load(std::get<0>(dataPrep).data());
-    bool ignore_array[] = { param_pack_load(std::get<I+1>(data), std::get<I+1>(dataPrep).data())... };
+    bool ignore_array[] = { (vector_lanes<typename std::tuple_element<I+1, decltype(data)>::type>::load(std::get<I+1>(data), std::get<I+1>(dataPrep).data()), false)... };
     (void) ignore_array;
 
     return data;
@@ -104,18 +222,682 @@ class read_event_data<1, BranchTypes, ReaderType, ReaderValueType> {
     }
 };
 
-// Helper to generate a valid TFile
-class TFileHelper {
-public:
-    TFileHelper(const std::string &fname) : m_tf(TFile::Open(fname.c_str())) {}
+/**
+ * BULK COLUMNAR READS FOR THE VECTORIZED STREAM
+ *
+ * Rather than calling TTreeReader::Next() and dereferencing each value once
+ * per event, the bulk reader asks each branch for whole baskets in their
+ * serialized form, byte-swaps them into an aligned contiguous buffer and
+ * hands out vector-sized slices.  Only branches holding a single,
+ * fixed-size primitive leaf whose type has a Vc equivalent are eligible;
+ * such a leaf may also be a data member of a split object.  Float16_t and
+ * Double32_t leaves are decoded from their reduced-precision encodings
+ * (see PackedFloat.h) into float and double columns.
+ */
+template<typename T>
+struct bulk_leaf_type {
+    static const bool value = false;
+    static const int streamer_type = -1;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return nullptr;}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<>
+struct bulk_leaf_type<float> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kFloat;
+    static const int packed_streamer_type = TVirtualStreamerInfo::kFloat16;
+    static const char *name() {return "Float_t";}
+    static const char *packed_name() {return "Float16_t";}
+};
 
-    TFile *get() {return m_tf;}
+template<>
+struct bulk_leaf_type<double> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kDouble;
+    static const int packed_streamer_type = TVirtualStreamerInfo::kDouble32;
+    static const char *name() {return "Double_t";}
+    static const char *packed_name() {return "Double32_t";}
+};
+
+template<>
+struct bulk_leaf_type<int> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kInt;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "Int_t";}
+    static const char *packed_name() {return nullptr;}
+};
 
-private:
-    TFile *m_tf{nullptr};
+template<>
+struct bulk_leaf_type<unsigned> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kUInt;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "UInt_t";}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<>
+struct bulk_leaf_type<short> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kShort;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "Short_t";}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<>
+struct bulk_leaf_type<unsigned short> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kUShort;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "UShort_t";}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<>
+struct bulk_leaf_type<unsigned char> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kUChar;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "UChar_t";}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<>
+struct bulk_leaf_type<long long> {
+    static const bool value = true;
+    static const int streamer_type = TVirtualStreamerInfo::kLong64;
+    static const int packed_streamer_type = -1;
+    static const char *name() {return "Long64_t";}
+    static const char *packed_name() {return nullptr;}
+};
+
+template<bool... B>
+struct bool_pack {};
+
+template<bool... B>
+using all_true = std::is_same<bool_pack<true, B...>, bool_pack<B..., true>>;
+
+template<typename BranchTypes>
+struct is_bulk_readable;
+
+template<typename... Args>
+struct is_bulk_readable<std::tuple<Args...>> {
+    static const bool value = all_true<bulk_leaf_type<Args>::value...>::value;
+};
+
+// Aligned storage for the decoded values of one branch.
+template<typename T>
+using bulk_buffer_t = std::vector<T, Vc::Allocator<T>>;
+
+// Size of a bulk buffer holding count entries: a whole number of vectors.
+inline Long64_t
+bulk_padded_size(Long64_t count) {
+    return ((count + vector_count - 1) / vector_count) * vector_count;
+}
+
+/**
+ * Look up a branch by name.  A member of a split object may be named by its
+ * path from the top-level branch ("event.fNtrack") even when the member's
+ * branch is not itself named that way.
+ */
+inline TBranch *
+resolve_branch(TTree *tree, const std::string &name) {
+    TBranch *branch = tree->GetBranch(name.c_str());
+    return branch ? branch : tree->FindBranch(name.c_str());
+}
+
+#ifdef TTREEPROCESSOR_TEST_HOOKS
+/**
+ * Test hooks, compiled in with -DTTREEPROCESSOR_TEST_HOOKS.
+ *
+ * Bulk reads of any range holding this entry fail, as when ROOT declines
+ * to hand out a basket.  -1 fails nothing.
+ */
+inline std::atomic<Long64_t> &
+bulk_read_fault_entry() {
+    static std::atomic<Long64_t> entry{-1};
+    return entry;
+}
+
+// Number of entries decoded by bulk reads, summed over the branches.
+inline std::atomic<Long64_t> &
+bulk_read_entry_count() {
+    static std::atomic<Long64_t> count{0};
+    return count;
+}
+#endif
+
+/**
+ * Decodes a range of entries of a single primitive branch into an aligned
+ * buffer, padded with zeros to a whole number of vectors.
+ */
+template<typename T>
+class TBulkColumn {
+  public:
+    TBulkColumn(TTree *tree, const std::string &name) :
+      m_branch(tree ? resolve_branch(tree, name) : nullptr),
+      m_packed(packed_encoding(m_branch)),
+      m_buf(TBuffer::kWrite, 32*1024)
+    {}
+
+    TBulkColumn(const TBulkColumn&) = delete;
+    TBulkColumn& operator=(const TBulkColumn&) = delete;
+
+    /**
+     * Returns true if the branch can be decoded by the bulk reader.
+     */
+    bool valid() const {
+        if (!bulk_leaf_type<T>::value || !m_branch) {return false;}
+        if (m_branch->IsA() == TBranchElement::Class()) {return valid_member();}
+        if (m_branch->IsA() != TBranch::Class()) {return false;}
+        TObjArray *leaves = m_branch->GetListOfLeaves();
+        if (leaves->GetEntriesFast() != 1) {return false;}
+        TLeaf *leaf = static_cast<TLeaf*>(leaves->UncheckedAt(0));
+        return !leaf->GetLeafCount() && (leaf->GetLenStatic() == 1) && (m_packed.packed() || !strcmp(leaf->GetTypeName(), bulk_leaf_type<T>::name()));
+    }
+
+    /**
+     * Decode entries [start, end) into the front of data.
+     */
+    bool fill(Long64_t start, Long64_t end, bulk_buffer_t<T> &data) {
+#ifdef TTREEPROCESSOR_TEST_HOOKS
+        Long64_t fault = bulk_read_fault_entry();
+        if (fault >= start && fault < end) {return false;}
+        bulk_read_entry_count() += end - start;
+#endif
+        Long64_t count = end - start;
+        data.resize(bulk_padded_size(count));
+        std::fill(data.begin() + count, data.end(), T());
+
+        Long64_t entry = start;
+        while (entry < end) {
+            Int_t basketCount = m_branch->GetBulkRead().GetEntriesSerialized(entry, m_buf);
+            if (basketCount <= 0) {return false;}
+            Long64_t basketStart = basket_start(entry);
+            Long64_t toCopy = std::min(basketStart + basketCount, end) - entry;
+            if (toCopy <= 0) {return false;}
+            copy_basket(entry - basketStart, data.data() + (entry - start), toCopy, has_packed_encoding());
+            entry += toCopy;
+        }
+        return true;
+    }
+
+  private:
+    // Only float and double columns can come from a Float16_t / Double32_t
+    // branch; no other column instantiates the packed decoder.
+    typedef std::integral_constant<bool, bulk_leaf_type<T>::packed_streamer_type != -1> has_packed_encoding;
+
+    // Copy count entries, starting offset entries into the basket, to dest.
+    void copy_basket(Long64_t offset, T *dest, Long64_t count, std::true_type) {
+        if (!m_packed.packed()) {return copy_basket(offset, dest, count, std::false_type());}
+        m_packed.decode(m_buf.GetCurrent() + offset*m_packed.width(), dest, count);
+    }
+
+    void copy_basket(Long64_t offset, T *dest, Long64_t count, std::false_type) {
+        char *src = m_buf.GetCurrent() + offset*sizeof(T);
+        for (Long64_t idx=0; idx<count; idx++) {
+            frombuf(src, dest + idx);
+        }
+    }
+
+    /**
+     * A basic-type data member of a split object (fType 0, no sub-branches)
+     * is streamed member-wise: its baskets hold one serialized value per
+     * entry, exactly like a plain leaf, and can be decoded without ever
+     * constructing the enclosing object.
+     */
+    bool valid_member() const {
+        TBranchElement *element = static_cast<TBranchElement*>(m_branch);
+        if (element->GetType() || element->GetListOfBranches()->GetEntriesFast() ||
+            (!m_packed.packed() && (element->GetStreamerType() != bulk_leaf_type<T>::streamer_type))) {return false;}
+        TObjArray *leaves = m_branch->GetListOfLeaves();
+        if (leaves->GetEntriesFast() != 1) {return false;}
+        TLeaf *leaf = static_cast<TLeaf*>(leaves->UncheckedAt(0));
+        return !leaf->GetLeafCount() && (leaf->GetLenStatic() == 1);
+    }
+
+    /**
+     * The encoding of a Float16_t (for a float column) or Double32_t (for a
+     * double column) branch; kNone for any other branch.  The range spec of
+     * a member comes from its streamer element, that of a leaf from the
+     * leaf's title.
+     */
+    static TPackedFloat packed_encoding(TBranch *branch) {
+        const char *packedName = bulk_leaf_type<T>::packed_name();
+        if (!branch || !packedName) {return TPackedFloat();}
+        bool isFloat16 = std::is_same<T, float>::value;
+        if (branch->IsA() == TBranchElement::Class()) {
+            TBranchElement *element = static_cast<TBranchElement*>(branch);
+            if (element->GetStreamerType() != bulk_leaf_type<T>::packed_streamer_type) {return TPackedFloat();}
+            return TPackedFloat(element->GetInfo()->GetElement(element->GetID()), isFloat16);
+        }
+        TObjArray *leaves = branch->GetListOfLeaves();
+        if (leaves->GetEntriesFast() != 1) {return TPackedFloat();}
+        TLeaf *leaf = static_cast<TLeaf*>(leaves->UncheckedAt(0));
+        if (strcmp(leaf->GetTypeName(), packedName)) {return TPackedFloat();}
+        TStreamerElement spec(leaf->GetName(), leaf->GetTitle(), 0, 0, packedName);
+        return TPackedFloat(&spec, isFloat16);
+    }
+
+    // The basket returned by GetEntriesSerialized starts at the basket's
+    // first entry, which is not necessarily the entry we asked for.
+    Long64_t basket_start(Long64_t entry) {
+        Long64_t *basketEntry = m_branch->GetBasketEntry();
+        Long64_t *last = basketEntry + m_branch->GetWriteBasket() + 1;
+        return *(std::upper_bound(basketEntry, last, entry) - 1);
+    }
+
+    TBranch *m_branch{nullptr};
+    TPackedFloat m_packed;
+    TBufferFile m_buf;
+};
+
+template<typename BranchTypes, typename Used = all_branches_t<BranchTypes>, typename Indices = std::make_index_sequence<std::tuple_size<BranchTypes>::value>>
+class TColumnCache;
+
+/**
+ * The decoded-column cache of one tree: a TColumnCacheFile per used
+ * primitive branch, named after the file's UUID, the tree and the branch,
+ * so that a rewritten input file never hits a stale cache.  Branches that
+ * cannot be bulk-read, or whose cache file cannot be mapped, are not cached.
+ */
+template<typename BranchTypes, bool... Used, std::size_t... I>
+class TColumnCache<BranchTypes, std::integer_sequence<bool, Used...>, std::index_sequence<I...>> {
+  public:
+    template<typename T>
+    using file_type = TColumnCacheFile<T, vector_count>;
+
+    TColumnCache(const std::string &directory, TFile *tf, const std::string &treeName,
+                 const typename internal::convert_to_strings<BranchTypes>::type &branch_names, Long64_t entries) :
+      m_files(make_file<typename std::tuple_element<I, BranchTypes>::type, Used>(path(directory, tf, treeName, std::get<I>(branch_names)), entries)...)
+    {}
+
+    // Cache of branch J; nullptr if the branch is not cached.
+    template<std::size_t J>
+    file_type<typename std::tuple_element<J, BranchTypes>::type> *column() const {return std::get<J>(m_files).get();}
+
+    static std::string path(const std::string &directory, TFile *tf, const std::string &treeName, const std::string &branch) {
+        std::string name = std::string(tf->GetUUID().AsString()) + "." + treeName + "." + branch + ".col";
+        std::replace(name.begin(), name.end(), '/', '_');
+        return directory + "/" + name;
+    }
+
+  private:
+    template<typename T, bool IsUsed>
+    static std::shared_ptr<file_type<T>> make_file(const std::string &path, Long64_t entries) {
+        if (!IsUsed || !bulk_leaf_type<T>::value) {return nullptr;}
+        auto file = std::make_shared<file_type<T>>(path, bulk_leaf_type<T>::name(), entries);
+        return file->valid() ? file : nullptr;
+    }
+
+    std::tuple<std::shared_ptr<file_type<typename std::tuple_element<I, BranchTypes>::type>>...> m_files;
+};
+
+template<typename BranchTypes, typename Used = all_branches_t<BranchTypes>, typename Indices = std::make_index_sequence<std::tuple_size<BranchTypes>::value>>
+class TBulkReader;
+
+template<typename BranchTypes, typename Indices = std::make_index_sequence<std::tuple_size<BranchTypes>::value>>
+class TBulkChunk;
+
+/**
+ * The decoded values of a range of entries, one aligned buffer per branch.
+ * Filled by a TBulkReader; owning the buffers separately from the reader
+ * lets a range be decoded on one thread and processed on another.  Columns
+ * found in a TColumnCache point into the cache's mapping instead.
+ */
+template<typename BranchTypes, std::size_t... I>
+class TBulkChunk<BranchTypes, std::index_sequence<I...>> {
+  public:
+    Long64_t start() const {return m_start;}
+    Long64_t size() const {return m_size;}
+
+    // Decoded values of branch J.
+    template<std::size_t J>
+    const typename std::tuple_element<J, BranchTypes>::type *data() const {return std::get<J>(m_data);}
+
+    // Event idx of the range, as a scalar tuple.
+    BranchTypes row(Long64_t idx) const {
+        return BranchTypes(std::get<I>(m_data)[idx]...);
+    }
+
+    /**
+     * Vectorized tuple for entries [offset, offset+vector_count) of the
+     * range; lanes past the end of the range are masked off.
+     */
+    vectorized_tuple_t<BranchTypes> get(Long64_t offset) const {
+        float remaining = std::min<Long64_t>(m_size - offset, vector_count);
+        return vectorized_tuple_t<BranchTypes>(floatv::IndexesFromZero() < floatv(remaining), load<I>(offset)...);
+    }
+
+    /**
+     * Serve entries [start, start+size) from columns owned by the caller.
+     * A range that does not fill whole vectors is copied into the chunk's
+     * own (padded) buffers, so get() never reads past the caller's data.
+     */
+    void assign(Long64_t start, Long64_t size, const typename std::tuple_element<I, BranchTypes>::type *... columns) {
+        if (size % vector_count) {
+            allocate(start, size);
+            bool ignore[] = {false, (std::copy(columns, columns + size, buffer<I>()), false)...};
+            (void)ignore;
+            return;
+        }
+        m_start = start;
+        m_size = size;
+        m_data = std::make_tuple(columns...);
+        m_borrowed.fill(true);
+    }
+
+    /**
+     * Size the chunk's own buffers for entries [start, start+size), zero
+     * the padding, and serve the range from them; the values are then
+     * written through buffer().
+     */
+    void allocate(Long64_t start, Long64_t size) {
+        m_start = start;
+        m_size = size;
+        bool ignore[] = {false, (allocate_column(std::get<I>(m_columns), size), false)...};
+        (void)ignore;
+        m_data = std::make_tuple(static_cast<const typename std::tuple_element<I, BranchTypes>::type*>(std::get<I>(m_columns).data())...);
+        m_borrowed.fill(false);
+    }
+
+    // Writable values of branch J, after allocate().
+    template<std::size_t J>
+    typename std::tuple_element<J, BranchTypes>::type *buffer() {return std::get<J>(m_columns).data();}
+
+  private:
+    // The chunk's own buffers are aligned; borrowed columns may not be.
+    template<std::size_t J>
+    vector_t<typename std::tuple_element<J, BranchTypes>::type> load(Long64_t offset) const {
+        const auto *data = std::get<J>(m_data) + offset;
+        typedef vector_t<typename std::tuple_element<J, BranchTypes>::type> vector_type;
+        return m_borrowed[J] ? vector_type(data, Vc::Unaligned) : vector_type(data, Vc::Aligned);
+    }
+
+    template<typename T>
+    static void allocate_column(bulk_buffer_t<T> &column, Long64_t size) {
+        column.resize(bulk_padded_size(size));
+        std::fill(column.begin() + size, column.end(), T());
+    }
+
+    template<typename, typename, typename> friend class TBulkReader;
+
+    std::tuple<bulk_buffer_t<typename std::tuple_element<I, BranchTypes>::type>...> m_columns;
+    // Start of each column's values: its buffer, or the cached mapping.
+    std::tuple<const typename std::tuple_element<I, BranchTypes>::type*...> m_data;
+    // Whether each column points outside the chunk's own buffers.
+    std::array<bool, sizeof...(I)> m_borrowed{};
+    Long64_t m_start{0};
+    Long64_t m_size{0};
+};
+
+/**
+ * Decodes a range of entries for every branch, then serves the range
+ * as vectorized tuples of vector_count events each.  Branches not set in
+ * Used are never read; their buffers hold zeros.
+ */
+template<typename BranchTypes, bool... Used, std::size_t... I>
+class TBulkReader<BranchTypes, std::integer_sequence<bool, Used...>, std::index_sequence<I...>> {
+  public:
+    // Number of entries decoded per fill; a multiple of vector_count.
+    static const Long64_t chunk_size = 4096;
+
+    TBulkReader(TTree *tree, const typename internal::convert_to_strings<BranchTypes>::type &branch_names,
+                const TColumnCache<BranchTypes, std::integer_sequence<bool, Used...>> *cache = nullptr) :
+      m_columns((Used ? std::make_shared<TBulkColumn<typename std::tuple_element<I, BranchTypes>::type>>(tree, std::get<I>(branch_names)) : nullptr)...),
+      m_cache(cache)
+    {}
+
+    bool valid() const {
+        bool is_valid[] = {true, (!std::get<I>(m_columns) || std::get<I>(m_columns)->valid())...};
+        return std::all_of(std::begin(is_valid), std::end(is_valid), [](bool v) {return v;});
+    }
+
+    /**
+     * Decode entries [start, end) into chunk.  With a column cache, ranges
+     * already cached are served from it and the others are added to it.
+     */
+    bool fill(Long64_t start, Long64_t end, TBulkChunk<BranchTypes> &chunk) {
+        chunk.m_start = start;
+        chunk.m_size = end - start;
+        bool filled[] = {true, fill_cached<I>(start, end, chunk)...};
+        return std::all_of(std::begin(filled), std::end(filled), [](bool v) {return v;});
+    }
+
+    /**
+     * Decode entries [start, end) into the reader's own chunk, accessed
+     * through the methods below.
+     */
+    bool fill(Long64_t start, Long64_t end) {return fill(start, end, m_chunk);}
+
+    Long64_t size() const {return m_chunk.size();}
+
+    // The current range.
+    const TBulkChunk<BranchTypes> &chunk() const {return m_chunk;}
+
+    // Decoded values of branch J for the current range.
+    template<std::size_t J>
+    const typename std::tuple_element<J, BranchTypes>::type *data() const {return m_chunk.template data<J>();}
+
+    /**
+     * Vectorized tuple for entries [offset, offset+vector_count) of the current
+     * range; lanes past the end of the range are masked off.
+     */
+    vectorized_tuple_t<BranchTypes> get(Long64_t offset) const {return m_chunk.get(offset);}
+
+  private:
+    template<std::size_t J>
+    bool fill_cached(Long64_t start, Long64_t end, TBulkChunk<BranchTypes> &chunk) {
+        auto *cached = m_cache ? m_cache->template column<J>() : nullptr;
+        if (cached && cached->covers(start, end)) {
+            std::get<J>(chunk.m_data) = cached->data() + start;
+            chunk.m_borrowed[J] = true;
+            return true;
+        }
+        auto &buffer = std::get<J>(chunk.m_columns);
+        if (!fill_column(std::get<J>(m_columns).get(), start, end, buffer)) {return false;}
+        std::get<J>(chunk.m_data) = buffer.data();
+        chunk.m_borrowed[J] = false;
+        if (cached) {cached->store(start, end, buffer.data());}
+        return true;
+    }
+
+    template<typename T>
+    static bool fill_column(TBulkColumn<T> *column, Long64_t start, Long64_t end, bulk_buffer_t<T> &data) {
+        if (column) {return column->fill(start, end, data);}
+        // Pruned branch: the buffer is only ever grown, so it stays zeroed.
+        Long64_t padded = bulk_padded_size(end - start);
+        if (static_cast<Long64_t>(data.size()) < padded) {data.resize(padded);}
+        return true;
+    }
+
+    std::tuple<std::shared_ptr<TBulkColumn<typename std::tuple_element<I, BranchTypes>::type>>...> m_columns;
+    const TColumnCache<BranchTypes, std::integer_sequence<bool, Used...>> *m_cache;
+    TBulkChunk<BranchTypes> m_chunk;
+};
+
+/**
+ * A TBB range over the entries of a tree, for tbb::parallel_for.
+ *
+ * Ranges are split at cluster boundaries where one lies near the middle,
+ * so that a task rarely decompresses a basket another task also reads.
+ * A range spanning fewer than two grains is never split: runs of small
+ * clusters are processed by a single task.  A large cluster is split
+ * internally (at a multiple of vector_count) only once the scheduler has no
+ * coarser work to hand out.
+ */
+class TClusterRange {
+  public:
+    // Minimum number of entries handed to a task.
+    static const Long64_t default_grain = 4096;
+
+    TClusterRange(TTree *tree, Long64_t grain = default_grain) :
+      TClusterRange(tree, 0, tree->GetEntries(), grain)
+    {}
+
+    // Entries [begin, end) of the tree; begin must start a cluster.
+    TClusterRange(TTree *tree, Long64_t begin, Long64_t end, Long64_t grain = default_grain) :
+      m_boundaries(std::make_shared<std::vector<Long64_t>>()),
+      m_begin(begin),
+      m_end(end),
+      m_grain(std::max<Long64_t>(grain, 1))
+    {
+        TTree::TClusterIterator clusterIter = tree->GetClusterIterator(begin);
+        Long64_t clusterStart;
+        while ( (clusterStart = clusterIter()) < m_end ) {
+            m_boundaries->push_back(clusterStart);
+        }
+        m_boundaries->push_back(m_end);
+    }
+
+    TClusterRange(TClusterRange &rhs, tbb::split) :
+      m_boundaries(rhs.m_boundaries),
+      m_begin(rhs.split_point()),
+      m_end(rhs.m_end),
+      m_grain(rhs.m_grain)
+    {
+        rhs.m_end = m_begin;
+    }
+
+    bool empty() const {return m_begin >= m_end;}
+    bool is_divisible() const {return m_end - m_begin >= 2*m_grain;}
+
+    Long64_t begin() const {return m_begin;}
+    Long64_t end() const {return m_end;}
+
+  private:
+    Long64_t split_point() const {
+        Long64_t length = m_end - m_begin;
+        Long64_t middle = m_begin + length/2;
+        // Accept a cluster boundary in the middle half of the range.
+        Long64_t low = std::max(m_begin + length/4, m_begin + m_grain);
+        Long64_t high = std::min(m_end - length/4, m_end - m_grain);
+        auto next = std::lower_bound(m_boundaries->begin(), m_boundaries->end(), middle);
+        Long64_t best = -1;
+        if (next != m_boundaries->end() && *next <= high) {best = *next;}
+        if (next != m_boundaries->begin() && *(next-1) >= low && (best < 0 || middle - *(next-1) < best - middle)) {best = *(next-1);}
+        if (best >= 0) {return best;}
+        return middle - (middle - m_begin) % vector_count;
+    }
+
+    std::shared_ptr<std::vector<Long64_t>> m_boundaries;
+    Long64_t m_begin{0};
+    Long64_t m_end{0};
+    Long64_t m_grain{default_grain};
+};
+
+/**
+ * Per-thread cache of the reader objects for a single input file.
+ *
+ * Opening the file, building the TTreeReader and registering one
+ * TTreeReaderValue per branch is expensive compared to processing a small
+ * cluster.  The pool builds these once per worker thread (on first use) and
+ * the caller re-targets the reader at each cluster with SetEntriesRange.
+ */
+template<typename BranchTypes, typename Used = all_branches_t<BranchTypes>>
+class TTreeReaderPool {
+    typedef typename internal::convert_to_strings<BranchTypes>::type branch_spec_tuple;
+
+  public:
+    typedef decltype(make_reader_tuple<BranchTypes>(std::declval<TTreeReader&>(), std::declval<branch_spec_tuple&>())) reader_values_type;
+    typedef TColumnCache<BranchTypes, Used> cache_type;
+
+    class Entry {
+      public:
+        // Reader over a file owned by the caller.
+        Entry(TFile *tf, const std::string &treeName, branch_spec_tuple &branches, const cache_type *cache = nullptr) :
+          m_file(tf),
+          m_branches(branches),
+          m_reader(treeName.c_str(), tf),
+          m_values(make_reader_tuple<BranchTypes, Used>(m_reader, branches)),
+          m_cache(cache)
+        {}
+
+        // Reader over a file it owns, closed along with the reader.
+        Entry(std::unique_ptr<TFile> tf, const std::string &treeName, branch_spec_tuple &branches, const cache_type *cache = nullptr) :
+          Entry(tf.get(), treeName, branches, cache)
+        {
+            m_owned_file = std::move(tf);
+        }
+
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        TFile *file() {return m_file;}
+        TTreeReader &reader() {return m_reader;}
+        reader_values_type &values() {return m_values;}
+
+        /**
+         * Bulk reader over the same tree; built on first use.
+         */
+        TBulkReader<BranchTypes, Used> &bulk() {
+            if (!m_bulk) {m_bulk.reset(new TBulkReader<BranchTypes, Used>(m_reader.GetTree(), m_branches, m_cache));}
+            return *m_bulk;
+        }
+
+        // Whether the bulk reader is backed by a decoded-column cache.
+        bool cached() const {return m_cache;}
+
+        /**
+         * Point the cached reader at the [start, end) entry range.
+         */
+        bool setRange(Long64_t start, Long64_t end) {
+            m_reader.Restart();
+            return m_reader.SetEntriesRange(start, end) == TTreeReader::kEntryValid;
+        }
+
+      private:
+        // Declared first so the file outlives the reader built on it.
+        std::unique_ptr<TFile> m_owned_file;
+        TFile *m_file;
+        branch_spec_tuple &m_branches;
+        TTreeReader m_reader;
+        reader_values_type m_values;
+        const cache_type *m_cache;
+        std::unique_ptr<TBulkReader<BranchTypes, Used>> m_bulk;
+    };
+
+    TTreeReaderPool(const std::string &fname, const std::string &treeName, branch_spec_tuple &branches, std::shared_ptr<cache_type> cache = nullptr) :
+      m_fname(fname), m_tree_name(treeName), m_branches(branches), m_cache(std::move(cache))
+    {}
+
+    /**
+     * Return the calling thread's reader; nullptr if the file could not
+     * be opened.  Opening the file and building the reader are recorded
+     * in tracer, if any.
+     */
+    Entry *get(TTaskTracer *tracer = nullptr) {
+        std::unique_ptr<Entry> &entry = m_entries.local();
+        if (!entry) {
+            std::unique_ptr<TFile> tf;
+            {
+                TTaskTracer::Span span(tracer, "open file");
+                tf.reset(TFile::Open(m_fname.c_str()));
+            }
+            if (!tf) {return nullptr;}
+            TTaskTracer::Span span(tracer, "build reader");
+            entry.reset(new Entry(std::move(tf), m_tree_name, m_branches, m_cache.get()));
+        }
+        return entry.get();
+    }
+
+    const std::string &file_name() const {return m_fname;}
+
+  private:
+    std::string m_fname;
+    std::string m_tree_name;
+    branch_spec_tuple &m_branches;
+    std::shared_ptr<cache_type> m_cache;
+    tbb::enumerable_thread_specific<std::unique_ptr<Entry>> m_entries;
 };
 
 }  // namespace internal
 
 }  // namespace ROOT
 
+
+#endif  // __ROOT_HELPERS_H_
@@ -1,17 +1,29 @@
 
+#include <algorithm>
+#include <limits>
+#include <mutex>
 #include <tuple>
 #include <string>
 #include <vector>
 #include <numeric>
 
+#include "tbb/blocked_range.h"
 #include "tbb/task_group.h"
+#include "tbb/task_arena.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_pipeline.h"
+#include "tbb/concurrent_queue.h"
 #include "tbb/enumerable_thread_specific.h"
 
+#include "ROOT/TBufferMerger.hxx"
+#include "TDirectory.h"
 #include "TFile.h"
+#include "TTree.h"
 #include "TTreeReader.h"
-#include "ROOT/TThreadedObject.hxx"
+#include "TROOT.h"
 
 #include "LambdaHelpers.h"
+#include "EntrySelection.h"
 #include "internal/GeneratedKernels.h"
 // We will need std::apply, which isn't available until C++17.
 #include "Backports.h"
@@ -19,6 +31,10 @@
 #include "Helpers.h"
 #include "RootHelpers.h"
 #include "VcHelpers.h"
+#include "BlockHelpers.h"
+#include "ClusterIndex.h"
+#include "DataSource.h"
+#include "Instrumentation.h"
 
 namespace ROOT {
 
@@ -95,12 +111,17 @@ class NoSuchTree : public std::exception {
 template<typename BranchTypes, typename ... ProcessingStages>
 class TTreeProcessor {
 
+    template<typename, typename...> friend class TTreeProcessor;
+
     typedef typename internal::convert_to_strings<BranchTypes>::type branch_spec_tuple;
     typedef typename internal::input_tuple_t<BranchTypes, ProcessingStages...> start_type;
     typedef typename internal::ProcessorResult<start_type, ProcessingStages...>::output_type end_type;
     template<class T> using stage_initializer_t = typename std::conditional<std::is_move_constructible<T>::value, T&&, T&>::type;
     template<class T> using stage_storage_t = typename std::conditional<std::is_move_constructible<T>::value, T, T&>::type;
     static const bool m_vectorized_stream = internal::is_vectorized_stream<BranchTypes, ProcessingStages...>::value;
+    typedef typename internal::chain_result<ProcessingStages...>::type result_type;
+    // Branches no stage looks at are never registered with the reader.
+    typedef internal::TTreeReaderPool<BranchTypes, typename internal::used_branches<BranchTypes, ProcessingStages...>::type> reader_pool_type;
 
   public:
     /**
@@ -123,9 +144,13 @@ class TTreeProcessor {
     }
 
     /**
-     * Processor object is not copyable or moveable.
+     * Processor object is not copyable.  Moving is only used to return a new
+     * chain from map / filter / count; the moved-from handle becomes invalid.
      */
-    TTreeProcessor(TTreeProcessor &&) = delete;
+    TTreeProcessor(TTreeProcessor && rhs) : m_valid(rhs.m_valid), m_block_size(rhs.m_block_size), m_range_cuts(std::move(rhs.m_range_cuts)), m_cache_dir(std::move(rhs.m_cache_dir)), m_report_file(std::move(rhs.m_report_file)), m_trace_file(std::move(rhs.m_trace_file)), m_branches(std::move(rhs.m_branches)), m_stage_state(std::move(rhs.m_stage_state))
+    {
+        rhs.m_valid = false;
+    }
     TTreeProcessor(TTreeProcessor const&) = delete;
     TTreeProcessor& operator=(TTreeProcessor const&) = delete;
 
@@ -133,138 +158,948 @@ class TTreeProcessor {
      * Add a mapping stage to the processor.  The argument must be a lambda that:
      * - Calling function takes the output from previous stage as input
      * - Returns a std::tuple.
+     *
+     * Scalar and vectorized stages may be mixed: if the lambda can't take the
+     * stream in its current form, the stream is packed into / unpacked from
+     * vectors in front of it.
      */
     template<typename T> // Hm - it's not clear if we can enforce any of the above with type traits?
-    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorMapperLambda, T, end_type>::type> &&
+    auto
     map(const T& fn) {
+      return add_stages(internal::generate_lambda_stages<internal::TTreeProcessorMapperLambda, T, end_type, stage_count == 0>::make(fn));
+    }
 
-      static const bool is_vectorized = internal::is_vectorized<typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorMapperLambda, T, end_type>::type, end_type>::value;
-
-      m_valid = false;
-      return internal::construct_processor<TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorMapperLambda, T, end_type>::type>, decltype(m_branches), decltype(m_stage_state), typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorMapperLambda, T, end_type>::type>
-      (
-          m_branches,
-          m_stage_state,
-          typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorMapperLambda, T, end_type>::type(fn)
-      );
+    /**
+     * Add a stage turning each event into zero or more tuples of type
+     * Output (a std::tuple), e.g. one per track.  The lambda takes the output
+     * of the previous stage followed by a callback, and calls the callback
+     * with the elements of each tuple it emits:
+     *
+     *   .flatMap<std::tuple<float>>([](ROOT::span<float> pt, auto &emit) {for (float x : pt) {emit(x);}})
+     *
+     * Emitted tuples go straight to the next stage; nothing is stored.  A
+     * vectorized stage after flatMap receives them packed into full vectors,
+     * regardless of which event they came from.
+     */
+    template<typename Output, typename T>
+    auto
+    flatMap(const T& fn) {
+      return add_stages(internal::generate_flat_map_stages<Output, T, end_type>::make(fn));
     }
 
     /**
      * Add a filter stage to the processor.  The argument must be a lambda that
      * - Takes the output from the previous stage as input.
-     * - Returns a bool.
+     * - Returns a bool (a mask for vectorized filters).
      * If the lambda returns false, the current event is ignored for the rest of the chain.
      */
     template<typename T>  // TODO: enforce calling signature via type_traits
-    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorFilterLambda, T, end_type>::type> &&
+    auto
     filter(const T& fn) {
-      m_valid = false;
-      return internal::construct_processor<TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorFilterLambda, T, end_type>::type>, decltype(m_branches), decltype(m_stage_state), typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorFilterLambda, T, end_type>::type>
-      (
-          m_branches,
-          m_stage_state,
-          typename internal::generate_lambda_type_vectorized<internal::TTreeProcessorFilterLambda, T, end_type>::type(fn)
-      );
+      return add_stages(internal::generate_lambda_stages<internal::TTreeProcessorFilterLambda, T, end_type, stage_count == 0>::make(fn));
+    }
+
+    /**
+     * Add a filter keeping the events whose branch I (in the order given to
+     * the constructor) lies in [lo, hi]; the branch must be numeric and the
+     * filter must precede any mapper.  If the input file has a cluster index
+     * covering the branch (see TClusterIndex::sidecar), the clusters whose
+     * values all fall outside the range are not read at all.
+     */
+    template<std::size_t I>
+    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::range_filter_type<I, end_type>::type>
+    filterRange(double lo, double hi) {
+      static_assert(internal::leading_filter_count<ProcessingStages...>::value == stage_count, "filterRange() must precede any mapper.");
+      static_assert(!internal::is_vectorized_tuple<end_type>::value, "filterRange() requires a scalar stream.");
+      static_assert(I < std::tuple_size<BranchTypes>::value, "filterRange() refers to a branch the processor does not read.");
+      m_range_cuts.push_back(TClusterIndex::Cut{std::get<I>(m_branches), lo, hi});
+      return add_stages(std::make_tuple(typename internal::range_filter_type<I, end_type>::type(lo, hi)));
+    }
+
+    /**
+     * Terminate a chain of filters by recording which entries pass them.
+     * The selection is written to `path` and returned by process /
+     * processParallel; handing it to process or processParallel later
+     * reads only the selected entries.  Only the branches the filters look
+     * at are read while recording.
+     */
+    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::selection_recorder_type<end_type>::type>
+    saveSelection(const std::string &path) {
+      static_assert(internal::leading_filter_count<ProcessingStages...>::value == stage_count, "saveSelection() may only follow filters.");
+      static_assert(!internal::is_vectorized_tuple<end_type>::value, "saveSelection() requires a scalar stream.");
+      return add_stages(std::make_tuple(typename internal::selection_recorder_type<end_type>::type(path)));
+    }
+
+    /**
+     * Terminate the chain by writing every event as an entry of a new tree
+     * `treeName` in `fileName` (recreated), with one branch per element of
+     * the stream named after branchNames.  Worker threads fill trees of
+     * their own that are merged into the output as they go (every
+     * autoFlush entries), so processParallel writes without locking; the
+     * order of the entries in the output is unspecified.  process /
+     * processParallel return the number of entries written.
+     */
+    template<typename Stages = internal::generate_scalar_terminal_stages<internal::snapshot_type, end_type>>
+    auto
+    snapshot(const std::string &treeName, const std::string &fileName, const typename Stages::terminal_stage::branch_names_type &branchNames, Long64_t autoFlush = 100000) {
+      return add_stages(Stages::make(treeName, fileName, branchNames, autoFlush));
+    }
+
+    /**
+     * Terminate the chain by gathering the events into memory: process /
+     * processParallel return a std::tuple of one std::vector per element of
+     * the stream (struct-of-arrays), holding the events in entry order,
+     * whatever order the worker threads processed them in.  Each range of
+     * entries is collected into its own chunk, reserved to the range's size;
+     * the chunks are concatenated once processing is done.
+     */
+    template<typename Stages = internal::generate_scalar_terminal_stages<internal::collector_type, end_type>>
+    auto
+    collect() {
+      return add_stages(Stages::make());
     }
 
     /**
      * Add a verbose counter - prints out how many events passed the map function.
      */
-    TTreeProcessor<BranchTypes, ProcessingStages..., internal::TTreeProcessorCountPrinter<end_type>> &&
+    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::count_printer_type<end_type>::type>
     count() {
-      m_valid = false;
-      return internal::construct_processor<TTreeProcessor<BranchTypes, ProcessingStages..., internal::TTreeProcessorCountPrinter<end_type>>, decltype(m_branches), decltype(m_stage_state), internal::TTreeProcessorCountPrinter<end_type>>
-      (
-          m_branches,
-          m_stage_state,
-          internal::TTreeProcessorCountPrinter<end_type>()
-      );
+      return add_stages(std::make_tuple(typename internal::count_printer_type<end_type>::type()));
+    }
+
+    /**
+     * Add a compaction stage to a vectorized chain.  Lanes masked off by
+     * earlier filters are squeezed out: surviving lanes are buffered and
+     * passed on as fully-packed vectors, so later stages run at full SIMD
+     * width.  Prints the lane occupancy achieved at the end.
+     */
+    TTreeProcessor<BranchTypes, ProcessingStages..., typename internal::compactor_type<end_type>::type>
+    compact() {
+      static_assert(internal::is_vectorized_tuple<end_type>::value, "compact() requires a vectorized stream.");
+      return add_stages(std::make_tuple(typename internal::compactor_type<end_type>::type()));
+    }
+
+    /**
+     * Terminate the chain with a reduction: every event is folded into a
+     * value of type T with `init = combine(init, args...)`, and process /
+     * processParallel return the final value.
+     *
+     * Each worker thread reduces into its own partial value, starting from
+     * init; the partials are merged with `combine(T, T)` at the end, so init
+     * must be an identity of combine and combine must be associative and
+     * commutative.  On a vectorized stream, a combine taking vectors (e.g. a
+     * generic lambda) reduces lane-wise, skipping masked-off lanes.
+     */
+    template<typename T, typename Combine>
+    auto
+    reduce(const T &init, const Combine &combine) {
+      static_assert(internal::is_callable_with_tuple<Combine, std::tuple<T, T>>::value,
+                    "reduce() merges the per-thread partial values with combine(T, T); use aggregate() to fold several columns with a separate merge.");
+      return add_stages(internal::generate_reducer_stages<T, Combine, end_type>::make(init, combine));
+    }
+
+    /**
+     * Terminate the chain with a user accumulator; process /
+     * processParallel return the merged accumulator.
+     *
+     * The accumulator is called for every event as `acc(args...)` (with the
+     * lane mask first on a vectorized stream, if it accepts vectors).  Each
+     * worker thread fills its own copy of `acc`, and the copies are combined
+     * with `acc.merge(const Acc &)` at the end.
+     */
+    template<typename Acc>
+    auto
+    aggregate(const Acc &acc) {
+      return add_stages(internal::generate_aggregator_stages<Acc, end_type>::make(acc));
+    }
+
+    /**
+     * Run a scalar chain block-at-a-time: block_size events are decoded into
+     * per-column arrays and each stage loops over the whole block before the
+     * next one runs, so plain scalar lambdas can be auto-vectorized by the
+     * compiler.  Emitters and anything after them still run per event.
+     * A block size of 0 (the default) processes one event at a time.  Has no
+     * effect on vectorized chains.
+     */
+    TTreeProcessor
+    blocks(std::size_t block_size = 1024) {
+      m_block_size = block_size;
+      return std::move(*this);
+    }
+
+    /**
+     * Cache the decoded primitive branches under `directory`.  The first
+     * pass over a file writes each range it decodes, uncompressed, into
+     * one memory-mapped file per branch (keyed by the file's UUID, the tree
+     * and the branch); later passes read cached ranges straight from the
+     * mapping instead of reading and decompressing baskets.  Scalar chains
+     * reading cached trees go through the bulk reader too.  Has no effect on
+     * trees whose branches cannot be bulk-read.
+     */
+    TTreeProcessor
+    cache(const std::string &directory) {
+      m_cache_dir = directory;
+      return std::move(*this);
+    }
+
+    /**
+     * Write the per-stage event counts and timings of each pass to
+     * fileName, as JSON, next to the table printed at the end of the pass.
+     * Only has an effect when compiled with -DTTREEPROCESSOR_INSTRUMENT;
+     * see Instrumentation.h.
+     */
+    TTreeProcessor
+    report(const std::string &fileName) {
+      m_report_file = fileName;
+      return std::move(*this);
+    }
+
+    /**
+     * Record a timeline of each pass and write it to fileName as Chrome
+     * trace JSON (open in chrome://tracing or Perfetto): for every range of
+     * entries handed to a task, the worker thread, file and entry range,
+     * and when the thread opened the file and built its reader, read the
+     * baskets and ran the chain.  See TaskTrace.h.
+     */
+    TTreeProcessor
+    trace(const std::string &fileName) {
+      m_trace_file = fileName;
+      return std::move(*this);
     }
 
     /**
      * Process a set of TTrees in a list of files.
      * 
      */
-    void process(const std::string &treeName, std::vector<TFile*> inputFiles) {
+    result_type process(const std::string &treeName, std::vector<TFile*> inputFiles) {
       if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(inputFiles);
 
       for (auto tf : inputFiles) {
-          TTreeReader myReader(treeName.c_str(), tf);
-          auto readerValues = internal::make_reader_tuple<BranchTypes>(myReader, m_branches);
-          while (myReader.Next()) {
-              start_type event_data = internal::read_event_data<m_vectorized_stream, BranchTypes, decltype(myReader), decltype(readerValues)>()(myReader, readerValues);
-              process_stages_helper(event_data);
+          TTree *tree = static_cast<TTree*>(tf->GetObjectChecked(treeName.c_str(), "TTree"));
+          if (!tree) {
+              throw NoSuchTree(treeName, tf);
+          }
+          auto cache = column_cache(tf, treeName, tree);
+          typename reader_pool_type::Entry entry(tf, treeName, m_branches, cache.get());
+          for (const auto &range : selected_ranges(tf, treeName, tree)) {
+              process_range(entry, range.first, range.second);
           }
       }
       finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
     }
 
-    void processParallel(const std::string &treeName, std::vector<TFile*> inputFiles) {
+    result_type processParallel(const std::string &treeName, std::vector<TFile*> inputFiles) {
+      if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(inputFiles);
+
+      tbb::task_group g;
+      // One reader pool per file; each worker thread builds its reader once and
+      // re-targets it at every range it is handed.
+      std::vector<std::unique_ptr<reader_pool_type>> pools;
+      pools.reserve(inputFiles.size());
+      for (auto tf : inputFiles) {
+          TTree *tree = static_cast<TTree*>(tf->GetObjectChecked(treeName.c_str(), "TTree"));
+          if (!tree) {
+              throw NoSuchTree(treeName, tf);
+          }
+          pools.emplace_back(new reader_pool_type(tf->GetEndpointUrl()->GetUrl(), treeName, m_branches, column_cache(tf, treeName, tree)));
+          reader_pool_type *pool = pools.back().get();
+          // Files are processed concurrently; within a file, the range of
+          // entries is split on demand (see TClusterRange), so idle workers
+          // steal part of a large cluster while small clusters are batched.
+          for (const auto &selected : selected_ranges(tf, treeName, tree)) {
+              internal::TClusterRange entries(tree, selected.first, selected.second);
+              g.run([&, pool, entries]() {
+                  tbb::parallel_for(entries, [&, pool](const internal::TClusterRange &range) {
+                      auto entry = pool->get(m_tracer.get());
+                      if (!entry) {
+                        std::cerr << "Failed to get thread-safe TFile object.\n";
+                        return;
+                      }
+                      process_range(*entry, range.begin(), range.end());
+                  });
+              });
+          }
+      }
+      g.wait();
+      finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
+    }
+
+    /**
+     * Process only the entries of a selection saved by saveSelection.
+     */
+    result_type process(const std::string &treeName, std::vector<TFile*> inputFiles, const TEntrySelection &selection) {
+      if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(inputFiles);
+
+      for (auto tf : inputFiles) {
+          TTree *tree = static_cast<TTree*>(tf->GetObjectChecked(treeName.c_str(), "TTree"));
+          if (!tree) {
+              throw NoSuchTree(treeName, tf);
+          }
+          auto cache = column_cache(tf, treeName, tree);
+          typename reader_pool_type::Entry entry(tf, treeName, m_branches, cache.get());
+          const TEntrySelection::runs_type &runs = selection.runs(tf->GetEndpointUrl()->GetUrl());
+          for (const auto &batch : cluster_batches(tree, runs)) {
+              process_runs(entry, runs.begin() + batch.first, runs.begin() + batch.second);
+          }
+      }
+      finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
+    }
+
+    /**
+     * Process only the entries of a selection saved by saveSelection, in
+     * parallel; the runs of selected entries in each cluster are read as
+     * one range.
+     */
+    result_type processParallel(const std::string &treeName, std::vector<TFile*> inputFiles, const TEntrySelection &selection) {
       if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(inputFiles);
 
       tbb::task_group g;
-      std::vector<std::shared_ptr<ROOT::TThreadedObject<internal::TFileHelper>>> scope_helper;  // Keep TThreadedObject in-scope.
-      scope_helper.reserve(inputFiles.size());
+      std::vector<std::unique_ptr<reader_pool_type>> pools;
+      pools.reserve(inputFiles.size());
+      std::vector<batches_type> batches;
+      batches.reserve(inputFiles.size());
       for (auto tf : inputFiles) {
-          scope_helper.emplace_back(std::make_shared<ROOT::TThreadedObject<internal::TFileHelper>>(tf->GetEndpointUrl()->GetUrl()));
-          ROOT::TThreadedObject<internal::TFileHelper> &ts_file = *(scope_helper.back());
-          Long64_t clusterStart;
           TTree *tree = static_cast<TTree*>(tf->GetObjectChecked(treeName.c_str(), "TTree"));
           if (!tree) {
               throw NoSuchTree(treeName, tf);
           }
-          TTree::TClusterIterator clusterIter = tree->GetClusterIterator(0);
-          while ( (clusterStart = clusterIter()) < tree->GetEntries() ) {
-              Long64_t clusterEnd = clusterIter.GetNextEntry();
-              g.run([&, clusterStart, clusterEnd]() {
-                  // TODO: Would make a lot of sense to reuse the reader/value objects via TThreadedObject.
-                  TFile *tf = (ts_file.Get())->get();
-                  if (!tf) {
+          pools.emplace_back(new reader_pool_type(tf->GetEndpointUrl()->GetUrl(), treeName, m_branches, column_cache(tf, treeName, tree)));
+          reader_pool_type *pool = pools.back().get();
+          const TEntrySelection::runs_type *runs = &selection.runs(tf->GetEndpointUrl()->GetUrl());
+          batches.emplace_back(cluster_batches(tree, *runs));
+          const batches_type *fileBatches = &batches.back();
+          g.run([&, pool, runs, fileBatches]() {
+              tbb::parallel_for(tbb::blocked_range<std::size_t>(0, fileBatches->size()), [&, pool, runs, fileBatches](const tbb::blocked_range<std::size_t> &range) {
+                  auto entry = pool->get(m_tracer.get());
+                  if (!entry) {
                     std::cerr << "Failed to get thread-safe TFile object.\n";
                     return;
                   }
-                  TTreeReader myReader(treeName.c_str(), tf);
-                  auto readerValues = internal::make_reader_tuple<BranchTypes>(myReader, m_branches);
-                  myReader.SetEntriesRange(clusterStart, clusterEnd);
-
-                  while (myReader.Next()) {
-                      auto event_data = internal::read_event_data<m_vectorized_stream, BranchTypes, decltype(myReader), decltype(readerValues)>()(myReader, readerValues);
-                      process_stages_helper(event_data);
+                  for (std::size_t idx = range.begin(); idx != range.end(); idx++) {
+                      const auto &batch = (*fileBatches)[idx];
+                      process_runs(*entry, runs->begin() + batch.first, runs->begin() + batch.second);
                   }
               });
-          }
+          });
       }
       g.wait();
       finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
+    }
+
+    /**
+     * Process the events of a TMemorySource or TSyntheticSource instead of
+     * a tree: nothing is read from disk, so the time taken is that of the
+     * chain alone.  The branch names given to the constructor are unused.
+     */
+    template<typename Source, typename = std::enable_if_t<internal::is_data_source<Source>::value>>
+    result_type process(const Source &source) {
+      if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(source);
+
+      internal::TBulkChunk<BranchTypes> chunk;
+      for (Long64_t start = 0; start < source.entries(); start += source.chunk_size) {
+          process_source_range(source, start, chunk);
+      }
+      finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
+    }
+
+    template<typename Source, typename = std::enable_if_t<internal::is_data_source<Source>::value>>
+    result_type processParallel(const Source &source) {
+      if (!m_valid) {throw InvalidProcessor();}
+      begin_processing(source);
+
+      tbb::enumerable_thread_specific<internal::TBulkChunk<BranchTypes>> chunks;
+      Long64_t count = (source.entries() + source.chunk_size - 1) / source.chunk_size;
+      tbb::parallel_for(tbb::blocked_range<Long64_t>(0, count), [&](const tbb::blocked_range<Long64_t> &range) {
+          auto &chunk = chunks.local();
+          for (Long64_t idx = range.begin(); idx != range.end(); idx++) {
+              process_source_range(source, idx * source.chunk_size, chunk);
+          }
+      });
+      finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
+    }
+
+    /**
+     * Process a set of TTrees in parallel, overlapping reading with
+     * computation.
+     *
+     * Entries are cut into clusters (small clusters are batched) that flow
+     * through a pipeline: each is first decoded into its own buffers, then
+     * the chain runs over the buffers.  While some workers run the chain,
+     * others decompress and decode the upcoming clusters.  At most
+     * maxInFlight clusters are between being read and finishing the chain,
+     * bounding the memory used; the default is twice the number of threads.
+     *
+     * Only primitive branches can be decoded ahead of time; other trees are
+     * read by the TTreeReader in the compute step, without overlap.
+     */
+    result_type processPipelined(const std::string &treeName, std::vector<TFile*> inputFiles, std::size_t maxInFlight = 0) {
+      if (!m_valid) {throw InvalidProcessor();}
+      if (!maxInFlight) {maxInFlight = 2*tbb::this_task_arena::max_concurrency();}
+      begin_processing(inputFiles);
+
+      std::vector<std::unique_ptr<reader_pool_type>> pools;
+      pools.reserve(inputFiles.size());
+      std::vector<std::tuple<reader_pool_type*, Long64_t, Long64_t>> ranges;
+      for (auto tf : inputFiles) {
+          TTree *tree = static_cast<TTree*>(tf->GetObjectChecked(treeName.c_str(), "TTree"));
+          if (!tree) {
+              throw NoSuchTree(treeName, tf);
+          }
+          pools.emplace_back(new reader_pool_type(tf->GetEndpointUrl()->GetUrl(), treeName, m_branches, column_cache(tf, treeName, tree)));
+          for (const auto &selected : selected_ranges(tf, treeName, tree)) {
+              Long64_t rangeStart = selected.first, clusterStart;
+              TTree::TClusterIterator clusterIter = tree->GetClusterIterator(selected.first);
+              while ( (clusterStart = clusterIter()) < selected.second ) {
+                  Long64_t clusterEnd = std::min(clusterIter.GetNextEntry(), selected.second);
+                  if (clusterEnd - rangeStart >= internal::TClusterRange::default_grain || clusterEnd >= selected.second) {
+                      ranges.emplace_back(pools.back().get(), rangeStart, clusterEnd);
+                      rangeStart = clusterEnd;
+                  }
+              }
+          }
+      }
+
+      // One set of buffers per token; a token's buffers are recycled once the
+      // chain is done with them.
+      std::vector<PipelineItem> items(maxInFlight);
+      tbb::concurrent_queue<PipelineItem*> freeItems;
+      for (auto &item : items) {freeItems.push(&item);}
+      std::size_t nextRange = 0;
+
+      tbb::parallel_pipeline(maxInFlight,
+          tbb::make_filter<void, PipelineItem*>(pipeline_mode::serial_in_order, [&](tbb::flow_control &fc) -> PipelineItem* {
+              PipelineItem *item = nullptr;
+              if (nextRange == ranges.size() || !freeItems.try_pop(item)) {
+                  fc.stop();
+                  return nullptr;
+              }
+              std::tie(item->pool, item->start, item->end) = ranges[nextRange++];
+              return item;
+          }) &
+          tbb::make_filter<PipelineItem*, PipelineItem*>(pipeline_mode::parallel, [&](PipelineItem *item) -> PipelineItem* {
+              decode_item(*item, decode_tag());
+              return item;
+          }) &
+          tbb::make_filter<PipelineItem*, void>(pipeline_mode::parallel, [&](PipelineItem *item) {
+              process_item(*item);
+              freeItems.push(item);
+          })
+      );
+      finalize();
+      return result(std::integral_constant<bool, internal::chain_result<ProcessingStages...>::is_terminated>());
     }
 
   private:
 
     static const unsigned int stage_count = sizeof...(ProcessingStages);
 
+    // Build a new processor with the given stages appended to this one.
+    template<typename... NewStages, std::size_t... I>
+    TTreeProcessor<BranchTypes, ProcessingStages..., NewStages...>
+    add_stages_helper(std::tuple<NewStages...> &&stages, std::index_sequence<I...>) {
+      static_assert(!internal::chain_result<ProcessingStages...>::is_terminated, "No stage may follow reduce() or aggregate().");
+      m_valid = false;
+      TTreeProcessor<BranchTypes, ProcessingStages..., NewStages...> result = internal::construct_processor<TTreeProcessor<BranchTypes, ProcessingStages..., NewStages...>, decltype(m_branches), decltype(m_stage_state), NewStages...>
+      (
+          m_branches,
+          m_stage_state,
+          std::get<I>(std::move(stages))...
+      );
+      result.m_block_size = m_block_size;
+      result.m_range_cuts = m_range_cuts;
+      result.m_cache_dir = m_cache_dir;
+      result.m_report_file = m_report_file;
+      result.m_trace_file = m_trace_file;
+      return result;
+    }
+
+    template<typename... NewStages>
+    TTreeProcessor<BranchTypes, ProcessingStages..., NewStages...>
+    add_stages(std::tuple<NewStages...> &&stages) {
+      return add_stages_helper(std::move(stages), std::index_sequence_for<NewStages...>());
+    }
+
+    /**
+     * The entry ranges of a tree to process.  With filterRange cuts and a
+     * cluster index for the file, clusters the index rules out are skipped.
+     */
+    std::vector<std::pair<Long64_t, Long64_t>> selected_ranges(TFile *tf, const std::string &treeName, TTree *tree) const {
+      if (!m_range_cuts.empty()) {
+        TClusterIndex index = TClusterIndex::load(TClusterIndex::sidecar(tf->GetName(), treeName));
+        if (index.matches(tree)) {return index.select(m_range_cuts);}
+      }
+      return {{0, tree->GetEntries()}};
+    }
+
+    // The decoded-column cache of a tree; nullptr unless enabled by cache().
+    std::shared_ptr<typename reader_pool_type::cache_type> column_cache(TFile *tf, const std::string &treeName, TTree *tree) const {
+      if (m_cache_dir.empty() || !internal::is_bulk_readable<BranchTypes>::value) {return nullptr;}
+      return std::make_shared<typename reader_pool_type::cache_type>(m_cache_dir, tf, treeName, m_branches, tree->GetEntries());
+    }
+
+    // Vectorized streams over primitive branches are read in bulk.
+    typedef std::integral_constant<bool, m_vectorized_stream && internal::is_bulk_readable<BranchTypes>::value> bulk_tag;
+
+    // Block mode: 0 if unavailable (vectorized stream), 1 to fill blocks from
+    // the TTreeReader, 2 to fill them from the bulk reader.
+    typedef std::integral_constant<unsigned int, m_vectorized_stream ? 0 : (internal::is_bulk_readable<BranchTypes>::value ? 2 : 1)> block_tag;
+
+    // Chains ending in saveSelection() only run their filters; see record_range.
+    typedef std::integral_constant<bool, internal::records_selection<ProcessingStages...>::value> record_tag;
+
+    // Chains ending in collect() keep the events of each range in order; see
+    // TTreeProcessorCollector.
+    typedef std::integral_constant<bool, internal::collects<ProcessingStages...>::value> collect_tag;
+
+    void begin_range(const std::string &file, Long64_t start, Long64_t end, std::true_type) {
+      stage<stage_count-1>().begin_range(file, start, end);
+    }
+
+    void begin_range(const std::string &, Long64_t, Long64_t, std::false_type) {}
+
+    void process_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end) {
+      internal::TAllEntries all;
+      process_range(entry, start, end, all);
+    }
+
+    /**
+     * Run the chain over the entries of [start, end) kept by selected: all
+     * of them (TAllEntries), or those of a replayed selection.
+     */
+    template<typename Selected>
+    void process_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected) {
+      internal::TTaskTracer::Span span(m_tracer.get(), "task", entry.file()->GetEndpointUrl()->GetUrl(), start, end);
+      begin_range(entry.file()->GetEndpointUrl()->GetUrl(), start, end, collect_tag());
+      if (record_tag::value) {
+        record_range(entry, start, end, selected, record_tag());
+      } else if (m_block_size && block_tag::value) {
+        process_blocks(entry, start, end, selected, block_tag());
+      } else {
+        process_range(entry, start, end, selected, bulk_tag());
+      }
+    }
+
+    // Runs [first, second) of a file's selection that lie in one cluster.
+    typedef std::vector<std::pair<std::size_t, std::size_t>> batches_type;
+
+    /**
+     * Group the runs of a selection by the cluster they start in, so that a
+     * replay reads each cluster as one range instead of restarting the
+     * reader for every run.
+     */
+    static batches_type cluster_batches(TTree *tree, const TEntrySelection::runs_type &runs) {
+      batches_type batches;
+      std::size_t idx = 0;
+      while (idx < runs.size()) {
+          TTree::TClusterIterator clusterIter = tree->GetClusterIterator(runs[idx].first);
+          clusterIter();
+          Long64_t clusterEnd = clusterIter.GetNextEntry();
+          std::size_t first = idx++;
+          while (idx < runs.size() && runs[idx].first < clusterEnd) {idx++;}
+          batches.emplace_back(first, idx);
+      }
+      return batches;
+    }
+
+    // Run the chain over the selected entries of runs [begin, end).
+    void process_runs(typename reader_pool_type::Entry &entry, TEntrySelection::runs_type::const_iterator begin, TEntrySelection::runs_type::const_iterator end) {
+      internal::TSelectedEntries selected(begin, end);
+      process_range(entry, begin->first, (end - 1)->second, selected);
+    }
+
+    // Run the chain over the chunk of a source starting at entry start.
+    template<typename Source>
+    void process_source_range(const Source &source, Long64_t start, internal::TBulkChunk<BranchTypes> &chunk) {
+      static_assert(!record_tag::value, "saveSelection() records entries of trees; it cannot run over a source.");
+      Long64_t end = std::min(start + source.chunk_size, source.entries());
+      internal::TTaskTracer::Span span(m_tracer.get(), "task", source.name().c_str(), start, end);
+      {
+        internal::TTaskTracer::Span read(m_tracer.get(), "read");
+        source.fill(start, end, chunk);
+      }
+      begin_range(source.name(), start, end, collect_tag());
+      internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+      process_chunk(chunk, std::integral_constant<bool, m_vectorized_stream>());
+    }
+
+    // parallel_pipeline filter modes moved from tbb::filter to tbb::filter_mode in oneTBB.
+#if TBB_INTERFACE_VERSION >= 12000
+    typedef tbb::filter_mode pipeline_mode;
+#else
+    typedef tbb::filter pipeline_mode;
+#endif
+
+    // A range of entries travelling through processPipelined.
+    struct PipelineItem {
+      reader_pool_type *pool{nullptr};
+      Long64_t start{0};
+      Long64_t end{0};
+      bool decoded{false};
+      internal::TBulkChunk<BranchTypes> chunk;
+    };
+
+    typedef std::integral_constant<bool, internal::is_bulk_readable<BranchTypes>::value && !record_tag::value> decode_tag;
+
+    // Decode the item's entries into its buffers, if the branches allow it.
+    void decode_item(PipelineItem &item, std::true_type) {
+      auto entry = item.pool->get(m_tracer.get());
+      internal::TTaskTracer::Span span(m_tracer.get(), "read");
+      item.decoded = entry && entry->bulk().valid() && entry->bulk().fill(item.start, item.end, item.chunk);
+    }
+
+    void decode_item(PipelineItem &item, std::false_type) {
+      item.decoded = false;
+    }
+
+    void process_item(PipelineItem &item) {
+      if (item.decoded) {
+        internal::TTaskTracer::Span span(m_tracer.get(), "task", item.pool->file_name().c_str(), item.start, item.end);
+        internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+        begin_range(item.pool->file_name(), item.start, item.end, collect_tag());
+        process_chunk(item.chunk, std::integral_constant<bool, m_vectorized_stream>());
+        return;
+      }
+      auto entry = item.pool->get(m_tracer.get());
+      if (!entry) {
+        std::cerr << "Failed to get thread-safe TFile object.\n";
+        return;
+      }
+      process_range(*entry, item.start, item.end);
+    }
+
+    /**
+     * Run the chain over an already-decoded range of entries.
+     */
+    void process_chunk(const internal::TBulkChunk<BranchTypes> &chunk, std::true_type) {
+      for (Long64_t offset = 0; offset < chunk.size(); offset += vector_count) {
+          process_stages_helper(chunk.get(offset));
+      }
+      flush_stages_helper();
+    }
+
+    void process_chunk(const internal::TBulkChunk<BranchTypes> &chunk, std::false_type) {
+      if (m_block_size) {
+        stage_blocks_type blocks;
+        internal::TBlockSelection selection;
+        internal::TAllEntries all;
+        process_block_source(chunk, blocks, selection, all);
+      } else {
+        internal::TAllEntries all;
+        process_rows(chunk, all);
+      }
+      flush_stages_helper();
+    }
+
+    template<typename Selected>
+    void process_rows(const internal::TBulkChunk<BranchTypes> &chunk, Selected &selected) {
+      for (Long64_t idx = 0; idx < chunk.size(); idx++) {
+          if (!selected.selected(chunk.start() + idx)) {continue;}
+          process_stages_helper(chunk.row(idx));
+      }
+    }
+
+    // Scalar chains over a cached tree read rows from the bulk reader.
+    typedef std::integral_constant<bool, decode_tag::value && !m_vectorized_stream> cached_rows_tag;
+
+    /**
+     * Run a scalar chain over entries [start, end) of a cached tree, one
+     * row at a time from the bulk reader.  Returns false if the branches
+     * cannot be bulk-read; the rest of the range goes to the TTreeReader if
+     * a basket cannot be decoded.
+     */
+    template<typename Selected>
+    bool process_cached_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::true_type) {
+      auto &bulk = entry.bulk();
+      if (!bulk.valid()) {return false;}
+      for (auto chunk = next_chunk(selected, start, end, bulk.chunk_size); chunk.first < chunk.second; chunk = next_chunk(selected, chunk.second, end, bulk.chunk_size)) {
+          Long64_t chunkStart = chunk.first, chunkEnd = chunk.second;
+          if (!fill_chunk(bulk, chunkStart, chunkEnd)) {
+            read_range(entry, chunkStart, end, selected);
+            return true;
+          }
+          internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+          process_rows(bulk.chunk(), selected);
+      }
+      internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+      flush_stages_helper();
+      return true;
+    }
+
+    template<typename Selected>
+    bool process_cached_range(typename reader_pool_type::Entry &, Long64_t, Long64_t, Selected &, std::false_type) {return false;}
+
+    /**
+     * Run the chain over entries [start, end) using the TTreeReader.
+     */
+    template<typename Selected>
+    void process_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::false_type) {
+      if (entry.cached() && process_cached_range(entry, start, end, selected, cached_rows_tag())) {return;}
+      read_range(entry, start, end, selected);
+    }
+
+    // Run the chain over entries [start, end), reading them with the TTreeReader.
+    template<typename Selected>
+    void read_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected) {
+      if (!entry.setRange(start, end)) {
+        std::cerr << "Failed to set entry range " << start << "-" << end << ".\n";
+        return;
+      }
+      TTreeReader &myReader = entry.reader();
+      auto &readerValues = entry.values();
+
+      internal::TTaskTracer::Span span(m_tracer.get(), "read+compute");
+      while (myReader.Next()) {
+          // Branches are read on access, so skipped entries cost no I/O.
+          if (!selected.selected(myReader.GetCurrentEntry())) {continue;}
+          process_event(myReader, readerValues, late_tag());
+      }
+      flush_stages_helper();
+    }
+
+    // Late materialization applies to scalar chains headed by filters that
+    // leave some branches unused (see ROOT::unused).
+    typedef internal::late_materialization<BranchTypes, ProcessingStages...> late_type;
+    typedef std::integral_constant<bool, !m_vectorized_stream && late_type::deferred> late_tag;
+    typedef std::integral_constant<bool, (late_type::filter_count < stage_count)> late_tail_tag;
+
+    template<typename ReaderValues>
+    void process_event(TTreeReader &myReader, ReaderValues &readerValues, std::false_type) {
+      start_type event_data = internal::read_event_data<m_vectorized_stream, BranchTypes, TTreeReader, ReaderValues>()(myReader, readerValues);
+      process_stages_helper(event_data);
+    }
+
+    template<typename ReaderValues>
+    void process_event(TTreeReader &, ReaderValues &readerValues, std::true_type) {
+      start_type event_data;
+      if (read_filtered_event(readerValues, event_data)) {
+        process_late_tail(event_data, late_tail_tag());
+      }
+    }
+
+    /**
+     * Read the branches needed by the leading filters and run them; only if
+     * the event passes are the remaining branches read.  The caller resumes
+     * the chain after the leading filters.
+     */
+    template<typename ReaderValues>
+    bool read_filtered_event(ReaderValues &readerValues, start_type &event_data) {
+      internal::read_event_branches<typename late_type::early>(event_data, readerValues);
+      if (!leading_filters_helper(event_data, std::make_index_sequence<late_type::filter_count>())) {return false;}
+      internal::read_event_branches<typename late_type::late>(event_data, readerValues);
+      return true;
+    }
+
+    template<std::size_t... I>
+    bool leading_filters_helper(const start_type &event_data, std::index_sequence<I...>) {
+      bool pass = true;
+      bool ignore_array[] = {false, (pass = pass && leading_filter<I>(event_data))...};
+      (void)ignore_array;
+      return pass;
+    }
+
+    template<std::size_t I>
+    bool leading_filter(const start_type &event_data) {
+      auto probe = this->template probe<I>();
+      probe.start(1);
+      bool pass = internal::std_future::apply_method(&std::decay_t<typename std::tuple_element<I, std::tuple<ProcessingStages...>>::type>::filter, stage<I>(), event_data);
+      probe.stop(pass);
+      return pass;
+    }
+
+    void process_late_tail(const start_type &event_data, std::true_type) {
+      (stage_helper_t<late_type::filter_count, typename std::decay<decltype(*this)>::type>(this))(event_data);
+    }
+
+    // The chain consists only of the filters.
+    void process_late_tail(const start_type &, std::false_type) {}
+
+    /**
+     * Run the leading filters over entries [start, end) and record the
+     * passing entries in the saveSelection stage.  Only the branches the
+     * filters need are read.
+     */
+    template<typename Selected>
+    void record_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::true_type) {
+      if (!entry.setRange(start, end)) {
+        std::cerr << "Failed to set entry range " << start << "-" << end << ".\n";
+        return;
+      }
+      TTreeReader &myReader = entry.reader();
+      auto &readerValues = entry.values();
+      auto &runs = stage<stage_count-1>().file_runs(entry.file()->GetEndpointUrl()->GetUrl());
+      start_type event_data;
+      internal::TTaskTracer::Span span(m_tracer.get(), "read+compute");
+      while (myReader.Next()) {
+          if (!selected.selected(myReader.GetCurrentEntry())) {continue;}
+          internal::read_event_branches<typename late_type::early>(event_data, readerValues);
+          if (leading_filters_helper(event_data, std::make_index_sequence<late_type::filter_count>())) {
+              TEntrySelection::append(runs, myReader.GetCurrentEntry());
+          }
+      }
+    }
+
+    template<typename Selected>
+    void record_range(typename reader_pool_type::Entry &, Long64_t, Long64_t, Selected &, std::false_type) {}
+
+    // Decode entries [start, end) into the bulk reader's chunk.
+    template<typename BulkReader>
+    bool fill_chunk(BulkReader &bulk, Long64_t start, Long64_t end) {
+      internal::TTaskTracer::Span span(m_tracer.get(), "read");
+      return bulk.fill(start, end);
+    }
+
+    /**
+     * The next chunk of [start, end) to decode: at most size entries, from
+     * the first selected entry to the last.  Empty once none are left, so
+     * stretches holding no selected entry are never decoded.
+     */
+    template<typename Selected>
+    static std::pair<Long64_t, Long64_t> next_chunk(Selected &selected, Long64_t start, Long64_t end, Long64_t size) {
+      Long64_t chunkStart = selected.next(start, end);
+      if (chunkStart == end) {return {end, end};}
+      return {chunkStart, selected.last(chunkStart, std::min(chunkStart + size, end))};
+    }
+
+    /**
+     * Run the chain over entries [start, end) by decoding whole baskets.
+     * Falls back to the TTreeReader if any branch cannot be bulk-read, or
+     * for the rest of the range if ROOT declines to hand out a basket
+     * (e.g. one written member-wise in a layout it cannot serve in bulk).
+     */
+    template<typename Selected>
+    void process_range(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::true_type) {
+      auto &bulk = entry.bulk();
+      if (!bulk.valid()) {
+        process_range(entry, start, end, selected, std::false_type());
+        return;
+      }
+      for (auto chunk = next_chunk(selected, start, end, bulk.chunk_size); chunk.first < chunk.second; chunk = next_chunk(selected, chunk.second, end, bulk.chunk_size)) {
+          Long64_t chunkStart = chunk.first, chunkEnd = chunk.second;
+          if (!fill_chunk(bulk, chunkStart, chunkEnd)) {
+            process_range(entry, chunkStart, end, selected, std::false_type());
+            return;
+          }
+          internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+          for (Long64_t offset = 0; offset < bulk.size(); offset += vector_count) {
+              start_type args = bulk.get(offset);
+              if (select_lanes(args, selected, chunkStart + offset)) {process_stages_helper(std::move(args));}
+          }
+      }
+      internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+      flush_stages_helper();
+    }
+
+    template<typename Selected>
+    void process_blocks(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::integral_constant<unsigned int, 0>) {
+      process_range(entry, start, end, selected, bulk_tag());
+    }
+
+    /**
+     * Run the chain over entries [start, end) a block at a time, filling
+     * each block from the TTreeReader.
+     */
+    template<typename Selected>
+    void process_blocks(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::integral_constant<unsigned int, 1>) {
+      if (!entry.setRange(start, end)) {
+        std::cerr << "Failed to set entry range " << start << "-" << end << ".\n";
+        return;
+      }
+      TTreeReader &myReader = entry.reader();
+      auto &readerValues = entry.values();
+      stage_blocks_type blocks;
+      internal::TBlockSelection selection;
+      auto &input = std::get<0>(blocks);
+
+      internal::TTaskTracer::Span span(m_tracer.get(), "read+compute");
+      bool more = true;
+      while (more) {
+          input.resize(m_block_size);
+          std::size_t count = 0;
+          while (count < m_block_size && (more = myReader.Next())) {
+              if (!selected.selected(myReader.GetCurrentEntry())) {continue;}
+              read_block_row(myReader, input, count, readerValues, late_tag());
+          }
+          if (!count) {break;}
+          input.resize(count);
+          selection.reset(count);
+          process_late_blocks(blocks, selection, late_tag());
+      }
+      flush_stages_helper();
+    }
+
+    /**
+     * Run the chain over entries [start, end) a block at a time, filling
+     * each block from the bulk reader.  Falls back to the TTreeReader if any
+     * branch cannot be bulk-read, or for the rest of the range if a basket
+     * cannot be decoded.
+     */
+    template<typename Selected>
+    void process_blocks(typename reader_pool_type::Entry &entry, Long64_t start, Long64_t end, Selected &selected, std::integral_constant<unsigned int, 2>) {
+      auto &bulk = entry.bulk();
+      if (!bulk.valid()) {
+        process_blocks(entry, start, end, selected, std::integral_constant<unsigned int, 1>());
+        return;
+      }
+      stage_blocks_type blocks;
+      internal::TBlockSelection selection;
+      for (auto chunk = next_chunk(selected, start, end, bulk.chunk_size); chunk.first < chunk.second; chunk = next_chunk(selected, chunk.second, end, bulk.chunk_size)) {
+          Long64_t chunkStart = chunk.first, chunkEnd = chunk.second;
+          if (!fill_chunk(bulk, chunkStart, chunkEnd)) {
+            process_blocks(entry, chunkStart, end, selected, std::integral_constant<unsigned int, 1>());
+            return;
+          }
+          internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+          process_block_source(bulk.chunk(), blocks, selection, selected);
+      }
+      internal::TTaskTracer::Span compute(m_tracer.get(), "compute");
+      flush_stages_helper();
+    }
+
     /**
      * ProcesorHelper assists in applying each consecutive stage in the chain.
      *
      * Template arguments:
      * - N: Current offset in the processing stages.
      * - M: Maximum number of stages to process.
-     * - IsMapper: Set to 1 if this is a mapper, 0 otherwise.
+     * - IsVectorized: Set to 1 if the input to this stage is a vectorized tuple.
+     * - IsMapper: Set to 1 if this is a mapper, 2 for an emitter, 0 otherwise.
      * - Processor: Base type of the processor.
      */
     template <unsigned int N, unsigned int M, unsigned int IsVectorized, unsigned int IsMapper, typename Processor>
     struct ProcessorHelper;
 
+    // Input type for stage N.
+    template <unsigned int N>
+    using stage_input_t = typename internal::ProcessorArgHelper<0, N, start_type, ProcessingStages...>::input_type;
+
+    // The helper that applies stage N.
+    template <unsigned int N, typename Processor>
+    using stage_helper_t = ProcessorHelper<N, stage_count-1, internal::is_vectorized_tuple<stage_input_t<N>>::value, internal::GetStageType<N, ProcessingStages...>::value, Processor>;
+
     // Recursion case for a mapper.
     template <unsigned int N, unsigned int M, unsigned int IsVectorized, typename Processor>
     struct ProcessorHelper<N, M, IsVectorized, 1, Processor> {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      static const unsigned int next_is_mapper = internal::GetStageType<N+1, ProcessingStages...>::value;
-
-      void operator()(typename internal::ProcessorArgHelper<0, N, BranchTypes, ProcessingStages...>::input_type arg_tuple) {
+      void operator()(stage_input_t<N> arg_tuple) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        (ProcessorHelper<N+1, M, IsVectorized, next_is_mapper, Processor>(m_p))( internal::std_future::apply_method(&stage_type::map, std::get<N>(m_p->m_stage_state), arg_tuple));
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        auto output = internal::std_future::apply_method(&stage_type::map, m_p->template stage<N>(), arg_tuple);
+        probe.stop(internal::event_count(output));
+        (stage_helper_t<N+1, Processor>(m_p))(std::move(output));
       }
     };
 
@@ -274,13 +1109,14 @@ class TTreeProcessor {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      static const unsigned int next_is_mapper = internal::GetStageType<N+1, ProcessingStages...>::value;
-
-      void operator()(typename internal::ProcessorArgHelper<0, N, BranchTypes, ProcessingStages...>::input_type arg_tuple) {
+      void operator()(stage_input_t<N> arg_tuple) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        bool result = internal::std_future::apply_method(&stage_type::filter, std::get<N>(m_p->m_stage_state), arg_tuple);
+        auto probe = m_p->template probe<N>();
+        probe.start(1);
+        bool result = internal::std_future::apply_method(&stage_type::filter, m_p->template stage<N>(), arg_tuple);
+        probe.stop(result);
         if (!result) {return;}  // Event did not pass the filter; stop processing.
-        (ProcessorHelper<N+1, M, 0, next_is_mapper, Processor>(m_p))( arg_tuple ); // Pass input argument directly to the next stage.
+        (stage_helper_t<N+1, Processor>(m_p))( arg_tuple ); // Pass input argument directly to the next stage.
       }
     };
 
@@ -290,15 +1126,33 @@ class TTreeProcessor {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      static const unsigned int next_is_mapper = internal::GetStageType<N+1, ProcessingStages...>::value;
-
-      void operator()(typename internal::ProcessorArgHelper<0, N, BranchTypes, ProcessingStages...>::input_type arg_tuple) {
+      void operator()(stage_input_t<N> arg_tuple) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        maskv result = internal::std_future::apply_method(&stage_type::filter, std::get<N>(m_p->m_stage_state), arg_tuple);
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        maskv result = internal::std_future::apply_method(&stage_type::filter, m_p->template stage<N>(), arg_tuple);
+        // Lanes failing the filter are masked out for the rest of the chain.
         // If all events in this vector are masked out, we stop processing.
-        // Note we do not repack the stream whenever an event is filtered.
-        if (result.isEmpty()) {return;}
-        (ProcessorHelper<N+1, M, 1, next_is_mapper, Processor>(m_p))( arg_tuple ); // Pass input argument directly to the next stage.
+        // Note we do not repack the stream here; add a compact() stage for that.
+        std::get<0>(arg_tuple) = std::get<0>(arg_tuple) && result;
+        probe.stop(internal::event_count(arg_tuple));
+        if (std::get<0>(arg_tuple).isEmpty()) {return;}
+        (stage_helper_t<N+1, Processor>(m_p))( arg_tuple );
+      }
+    };
+
+    // Recursion case for an emitter; its output is pushed directly to the
+    // next stage.
+    template <unsigned int N, unsigned int M, unsigned int IsVectorized, typename Processor>
+    struct ProcessorHelper<N, M, IsVectorized, 2, Processor> {
+      ProcessorHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(stage_input_t<N> arg_tuple) {
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        m_p->template stage<N>().push(arg_tuple, probe.wrap(stage_helper_t<N+1, Processor>(m_p)));
+        probe.stop(0);
       }
     };
 
@@ -308,9 +1162,12 @@ class TTreeProcessor {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      void operator()(typename internal::ProcessorArgHelper<0, N, start_type, ProcessingStages...>::input_type arg_tuple) __attribute__((always_inline)) {
+      void operator()(stage_input_t<N> arg_tuple) __attribute__((always_inline)) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        internal::std_future::apply_method(&stage_type::map, std::get<N>(m_p->m_stage_state), arg_tuple);
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        internal::std_future::apply_method(&stage_type::map, m_p->template stage<N>(), arg_tuple);
+        probe.stop(internal::event_count(arg_tuple));
       }
     };
 
@@ -322,9 +1179,12 @@ class TTreeProcessor {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      void operator()(typename internal::ProcessorArgHelper<0, N, BranchTypes, ProcessingStages...>::input_type arg_tuple) __attribute__((always_inline)) {
+      void operator()(stage_input_t<N> arg_tuple) __attribute__((always_inline)) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        internal::std_future::apply_method(&stage_type::filter, std::get<N>(m_p->m_stage_state), arg_tuple);
+        auto probe = m_p->template probe<N>();
+        probe.start(1);
+        bool result = internal::std_future::apply_method(&stage_type::filter, m_p->template stage<N>(), arg_tuple);
+        probe.stop(result);
       }
     };
 
@@ -333,35 +1193,360 @@ class TTreeProcessor {
       ProcessorHelper(Processor *p_) : m_p(p_) {}
       Processor *m_p;
 
-      void operator()(typename internal::ProcessorArgHelper<0, N, BranchTypes, ProcessingStages...>::input_type arg_tuple) __attribute__((always_inline)) {
+      void operator()(stage_input_t<N> arg_tuple) __attribute__((always_inline)) {
         typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
-        internal::std_future::apply_method(&stage_type::filter, std::get<N>(m_p->m_stage_state), arg_tuple);
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        maskv result = internal::std_future::apply_method(&stage_type::filter, m_p->template stage<N>(), arg_tuple);
+        probe.stop((std::get<0>(arg_tuple) && result).count());
       }
     };
 
+    // Base case for an emitter; there is nothing downstream to emit to.
+    template <unsigned int N, unsigned int IsVectorized, typename Processor>
+    struct ProcessorHelper<N, N, IsVectorized, 2, Processor> {
+      ProcessorHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(stage_input_t<N> arg_tuple) __attribute__((always_inline)) {
+        auto probe = m_p->template probe<N>();
+        probe.start(internal::event_count(arg_tuple));
+        m_p->template stage<N>().push(arg_tuple, probe.wrap([](const typename internal::ProcessorApply<std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type>, stage_input_t<N>>::type &) {}));
+        probe.stop(0);
+      }
+    };
+
+    // Block holding the input of stage N.
+    template <unsigned int N>
+    using stage_block_t = internal::block_storage_t<stage_input_t<N>>;
+
+    template <typename Indices>
+    struct stage_blocks_helper;
+
+    template <std::size_t... I>
+    struct stage_blocks_helper<std::index_sequence<I...>> {
+      typedef std::tuple<stage_block_t<I>...> type;
+    };
+
+    // One block per stage input, owned by the range being processed.
+    typedef typename stage_blocks_helper<std::make_index_sequence<stage_count>>::type stage_blocks_type;
+
+    /**
+     * BlockHelper runs stage N over every selected row of its input block.
+     * Mappers write into the input block of stage N+1; filters only refine
+     * the selection.  Emitters, whose output count is not known up front,
+     * hand each selected row to the event-at-a-time ProcessorHelper.
+     *
+     * Template arguments match ProcessorHelper; the input of a block stage is
+     * always scalar.
+     */
+    template <unsigned int N, unsigned int M, unsigned int StageType, typename Processor>
+    struct BlockHelper;
+
+    template <unsigned int N, typename Processor>
+    using block_helper_t = BlockHelper<N, stage_count-1, internal::GetStageType<N, ProcessingStages...>::value, Processor>;
+
+    // Recursion case for a mapper.
+    template <unsigned int N, unsigned int M, typename Processor>
+    struct BlockHelper<N, M, 1, Processor> {
+      BlockHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(const stage_block_t<N> &input, stage_blocks_type &blocks, internal::TBlockSelection &selection) {
+        typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
+        auto &stage = m_p->template stage<N>();
+        auto &output = std::get<N+1>(blocks);
+        auto probe = m_p->template probe<N>();
+        probe.start(selection.count(), true);
+        input.transform([&](const stage_input_t<N> &arg_tuple) {
+            return internal::std_future::apply_method(&stage_type::map, stage, arg_tuple);
+          }, output, selection);
+        probe.stop(selection.count());
+        (block_helper_t<N+1, Processor>(m_p))(output, blocks, selection);
+      }
+    };
+
+    // Recursion case for a filter.
+    template <unsigned int N, unsigned int M, typename Processor>
+    struct BlockHelper<N, M, 0, Processor> {
+      BlockHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(const stage_block_t<N> &input, stage_blocks_type &blocks, internal::TBlockSelection &selection) {
+        typedef std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> stage_type;
+        auto &stage = m_p->template stage<N>();
+        auto probe = m_p->template probe<N>();
+        probe.start(selection.count(), true);
+        selection.refine([&](std::size_t idx) -> bool {
+            return internal::std_future::apply_method(&stage_type::filter, stage, input.row(idx));
+          });
+        probe.stop(selection.count());
+        if (selection.empty()) {return;}  // No event in the block passed; stop processing.
+        (block_helper_t<N+1, Processor>(m_p))(input, blocks, selection); // The block is passed on unchanged.
+      }
+    };
+
+    // Emitters (and everything downstream of them) run event-at-a-time.
+    template <unsigned int N, unsigned int M, typename Processor>
+    struct BlockHelper<N, M, 2, Processor> {
+      BlockHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(const stage_block_t<N> &input, stage_blocks_type &, internal::TBlockSelection &selection) {
+        selection.for_each([&](std::size_t idx) {(stage_helper_t<N, Processor>(m_p))(input.row(idx));});
+      }
+    };
+
+    // Base case for a mapper; its output is discarded, so there is no block
+    // to fill.
+    template <unsigned int N, typename Processor>
+    struct BlockHelper<N, N, 1, Processor> {
+      BlockHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(const stage_block_t<N> &input, stage_blocks_type &, internal::TBlockSelection &selection) {
+        selection.for_each([&](std::size_t idx) {(stage_helper_t<N, Processor>(m_p))(input.row(idx));});
+      }
+    };
+
+    // Base case for a filter.
+    template <unsigned int N, typename Processor>
+    struct BlockHelper<N, N, 0, Processor> {
+      BlockHelper(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()(const stage_block_t<N> &input, stage_blocks_type &, internal::TBlockSelection &selection) {
+        selection.for_each([&](std::size_t idx) {(stage_helper_t<N, Processor>(m_p))(input.row(idx));});
+      }
+    };
+
+    /**
+     * StageFlusher is called at the end of each entry range; every emitter in
+     * the chain (in order) passes its buffered tuples downstream.
+     */
+    template <unsigned int N, unsigned int M, unsigned int StageType, typename Processor>
+    struct StageFlusher {
+      StageFlusher(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()() {
+        (StageFlusher<N+1, M, internal::GetStageType<N+1, ProcessingStages...>::value, Processor>(m_p))();
+      }
+    };
+
+    template <unsigned int N, unsigned int StageType, typename Processor>
+    struct StageFlusher<N, N, StageType, Processor> {
+      StageFlusher(Processor *) {}
+
+      void operator()() {}
+    };
+
+    template <unsigned int N, unsigned int M, typename Processor>
+    struct StageFlusher<N, M, 2, Processor> {
+      StageFlusher(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()() {
+        auto probe = m_p->template probe<N>();
+        m_p->template stage<N>().flush(probe.wrap(stage_helper_t<N+1, Processor>(m_p)));
+        (StageFlusher<N+1, M, internal::GetStageType<N+1, ProcessingStages...>::value, Processor>(m_p))();
+      }
+    };
+
+    template <unsigned int N, typename Processor>
+    struct StageFlusher<N, N, 2, Processor> {
+      StageFlusher(Processor *p_) : m_p(p_) {}
+      Processor *m_p;
+
+      void operator()() {
+        auto probe = m_p->template probe<N>();
+        m_p->template stage<N>().flush(probe.wrap([](const typename internal::ProcessorApply<std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type>, stage_input_t<N>>::type &) {}));
+      }
+    };
+
+    void
+    flush_stages_helper() {
+      (StageFlusher<0, stage_count-1, internal::GetStageType<0, ProcessingStages...>::value, typename std::decay<decltype(*this)>::type>(this))();
+    }
+
+    // Run the chain a block at a time over the entries of a decoded chunk
+    // kept by selected.
+    template<typename Selected>
+    void process_block_source(const internal::TBulkChunk<BranchTypes> &source, stage_blocks_type &blocks, internal::TBlockSelection &selection, Selected &selected) {
+      for (Long64_t offset = 0; offset < source.size(); offset += m_block_size) {
+          std::size_t count = std::min<Long64_t>(m_block_size, source.size() - offset);
+          std::get<0>(blocks).load(source, offset, count);
+          selection.reset(count);
+          select_rows(selection, selected, source.start() + offset);
+          if (selection.empty()) {continue;}
+          process_block_helper(blocks, selection);
+      }
+    }
+
+    // Drop the rows of a block, starting at entry first, that selected skips.
+    void select_rows(internal::TBlockSelection &, internal::TAllEntries &, Long64_t) {}
+
+    void select_rows(internal::TBlockSelection &selection, internal::TSelectedEntries &selected, Long64_t first) {
+      selection.refine([&](std::size_t idx) {return selected.selected(first + idx);});
+    }
+
+    // Mask off the lanes of args, starting at entry first, that selected
+    // skips; returns false if no lane is left.
+    bool select_lanes(start_type &, internal::TAllEntries &, Long64_t) {return true;}
+
+    bool select_lanes(start_type &args, internal::TSelectedEntries &selected, Long64_t first) {
+      bool lanes[vector_count];
+      for (std::size_t lane = 0; lane < vector_count; lane++) {lanes[lane] = selected.selected(first + lane);}
+      maskv mask;
+      mask.load(lanes);
+      std::get<0>(args) &= mask;
+      return !std::get<0>(args).isEmpty();
+    }
+
+    template<typename ReaderValues>
+    void read_block_row(TTreeReader &myReader, stage_block_t<0> &input, std::size_t &count, ReaderValues &readerValues, std::false_type) {
+      input.set(count++, internal::read_event_data<false, BranchTypes, TTreeReader, ReaderValues>()(myReader, readerValues));
+    }
+
+    // With late materialization, the leading filters run as the block is
+    // filled and only passing events are stored.
+    template<typename ReaderValues>
+    void read_block_row(TTreeReader &, stage_block_t<0> &input, std::size_t &count, ReaderValues &readerValues, std::true_type) {
+      start_type event_data;
+      if (read_filtered_event(readerValues, event_data)) {
+        input.set(count++, event_data);
+      }
+    }
+
+    void process_late_blocks(stage_blocks_type &blocks, internal::TBlockSelection &selection, std::false_type) {
+      process_block_helper(blocks, selection);
+    }
+
+    void process_late_blocks(stage_blocks_type &blocks, internal::TBlockSelection &selection, std::true_type) {
+      process_late_blocks_tail(blocks, selection, late_tail_tag());
+    }
+
+    void process_late_blocks_tail(stage_blocks_type &blocks, internal::TBlockSelection &selection, std::true_type) {
+      (block_helper_t<late_type::filter_count, typename std::decay<decltype(*this)>::type>(this))(std::get<0>(blocks), blocks, selection);
+    }
+
+    void process_late_blocks_tail(stage_blocks_type &, internal::TBlockSelection &, std::false_type) {}
+
+    void
+    process_block_helper(stage_blocks_type &blocks, internal::TBlockSelection &selection) {
+      (block_helper_t<0, typename std::decay<decltype(*this)>::type>(this))(std::get<0>(blocks), blocks, selection);
+    }
 
     void
     process_stages_helper(start_type args) {
-      ProcessorHelper<0, stage_count-1, m_vectorized_stream, internal::GetStageType<0, ProcessingStages...>::value, typename std::decay<decltype(*this)>::type>(this)(args);
+      (stage_helper_t<0, typename std::decay<decltype(*this)>::type>(this))(args);
     };
 
-    // Invoke all the finalize methods.
+    // Per-thread clones of the thread-local stages; only set while processing.
+    typedef std::tuple<internal::TTreeProcessorStageClones<std::decay_t<ProcessingStages>>...> stage_clones_type;
+
+    /**
+     * The instance of stage N to use on the calling thread.
+     */
+    template <unsigned int N>
+    std::decay_t<typename std::tuple_element<N, std::tuple<ProcessingStages...>>::type> &
+    stage() {
+        return std::get<N>(*m_stage_clones).local(std::get<N>(m_stage_state));
+    }
+
+    // Records a call of stage N on the calling thread; see Instrumentation.h.
+    template <std::size_t N>
+    auto
+    probe() {
+        return m_statistics.template probe<N>();
+    }
+
+    template <std::size_t ...I>
+    void clone_stages_helper (std::index_sequence<I...>) {
+        m_stage_clones.reset(new stage_clones_type(std::get<I>(m_stage_state)...));
+    }
+
+    // Called before any event is processed.
+    void
+    clone_stages() {
+        clone_stages_helper( std::make_index_sequence< sizeof...(ProcessingStages) >() );
+    }
+
+    void order_inputs(const std::vector<std::string> &inputs, std::true_type) {
+        std::get<stage_count-1>(m_stage_state).set_inputs(inputs);
+    }
+
+    void order_inputs(const std::vector<std::string> &, std::false_type) {}
+
+    // Called by each process method before any event is processed.
+    void
+    begin_processing(const std::vector<std::string> &inputs) {
+        order_inputs(inputs, collect_tag());
+        m_statistics.reset();
+        m_tracer.reset(m_trace_file.empty() ? nullptr : new internal::TTaskTracer());
+        clone_stages();
+    }
+
+    void
+    begin_processing(const std::vector<TFile*> &inputFiles) {
+        std::vector<std::string> inputs;
+        for (auto tf : inputFiles) {inputs.push_back(tf->GetEndpointUrl()->GetUrl());}
+        begin_processing(inputs);
+    }
+
+    void
+    begin_processing(const internal::TDataSourceBase &source) {
+        begin_processing(std::vector<std::string>{source.name()});
+    }
+
+    // Merge the per-thread clones, then invoke all the finalize methods.
     template <std::size_t ...I>
     void finalize_helper (std::index_sequence<I...>) {
+        bool ignore_array[] = {false, (std::get<I>(*m_stage_clones).merge(std::get<I>(m_stage_state)), false)...};
+        (void)ignore_array;
+        m_stage_clones.reset();
         std::make_tuple(std::get<I>(m_stage_state).finalize() ...);
+        m_statistics.report({stage_kind(internal::GetStageType<I, ProcessingStages...>::value)...},
+                            {internal::is_vectorized_tuple<stage_input_t<I>>::value...},
+                            m_report_file);
+    }
+
+    static const char *
+    stage_kind(unsigned int type) {
+        return type == 0 ? "filter" : (type == 1 ? "map" : "emit");
     }
 
     void
     finalize() {
         finalize_helper( std::make_index_sequence< sizeof...(ProcessingStages) >() );
+        if (m_tracer) {
+            m_tracer->write(m_trace_file);
+            m_tracer.reset();
+        }
+    }
+
+    result_type result(std::false_type) {}
+
+    // The chain ends in a terminal stage; return its result.
+    result_type result(std::true_type) {
+        return std::get<stage_count-1>(m_stage_state).result();
     }
 
     bool m_valid{true};
+    std::size_t m_block_size{0};
+    std::vector<TClusterIndex::Cut> m_range_cuts;
+    std::string m_cache_dir;
+    std::string m_report_file;
+    std::string m_trace_file;
     branch_spec_tuple m_branches;
 
     // If the type is move constructible, perform the move.
     // Otherwise, take a reference.
     std::tuple< stage_storage_t<ProcessingStages>...> m_stage_state;
+    std::unique_ptr<stage_clones_type> m_stage_clones;
+    internal::TChainStatistics<internal::instrumented, sizeof...(ProcessingStages)> m_statistics;
+    // Only set while processing, if trace() was called.
+    std::unique_ptr<internal::TTaskTracer> m_tracer;
 };
 
 }
@@ -1,6 +1,8 @@
 #ifndef __TTREE_PROCESSOR_KERNELS_H_
 #define __TTREE_PROCESSOR_KERNELS_H_
 
+#include <type_traits>
+
 namespace ROOT {
 
 namespace internal {
@@ -28,8 +30,72 @@ class TTreeProcessorMapperBase {};
  */
 class TTreeProcessorFilterBase {};
 
+/**
+ * The base class for emitters: stages that pass zero or more tuples
+ * downstream for each input (via `push`) and may hold buffered tuples back
+ * until the end of an entry range (`flush`).  The output tuple type is
+ * given by the `output_type` typedef.
+ *
+ * Used internally for compaction and for switching between scalar and
+ * vectorized streams.
+ */
+class TTreeProcessorEmitterBase {};
+
+/**
+ * The base class for stages cloned per worker thread; see
+ * TTreeProcessorThreadLocal.
+ */
+class TTreeProcessorThreadLocalBase {};
+
+/**
+ * The base class for terminal stages (reduce, aggregate): a terminal must
+ * be the last stage of a chain and its `result()`, of type `result_type`,
+ * is returned by process / processParallel.
+ */
+class TTreeProcessorTerminalBase {};
+
+template<typename T>
+struct is_terminal_stage : std::is_base_of<TTreeProcessorTerminalBase, T> {};
+
 }  // internal
 
+/**
+ * Mix-in for stages with mutable state.
+ *
+ * For each call to process / processParallel, every worker thread gets its
+ * own copy of the stage (made with the copy constructor), so `map` or
+ * `filter` may update members without atomics or locks.  At the end, each
+ * copy is passed to `merge` on the original stage, then the original's
+ * `finalize` is called.  The stage must provide:
+ *
+ *   Stage(const Stage &);              // Creates an empty per-thread clone.
+ *   void merge(const Stage &clone);    // Folds a clone's state into this one.
+ */
+class TTreeProcessorThreadLocal : public internal::TTreeProcessorThreadLocalBase {};
+
+/**
+ * Trait selecting which stages are cloned per thread.  Defaults to the
+ * stages deriving from TTreeProcessorThreadLocal; may be specialized for
+ * stages that cannot change their base class.
+ */
+template<typename T>
+struct is_thread_local_stage : std::is_base_of<internal::TTreeProcessorThreadLocalBase, T> {};
+
+/**
+ * Placeholder type for a stage argument that is not looked at.
+ *
+ * A lambda taking `ROOT::unused` in place of a branch value tells the
+ * processor it does not need that branch; e.g. a leading filter
+ *
+ *   .filter([](float pt, ROOT::unused, ROOT::unused) {return pt > 20;})
+ *
+ * lets the processor read the other branches only for events that pass.
+ */
+struct unused {
+    unused() {}
+    template<typename T> unused(const T &) {}
+};
+
 /**
  * The base implementation of mappers.
  *
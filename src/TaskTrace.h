@@ -0,0 +1,143 @@
+#ifndef __TASK_TRACE_H_
+#define __TASK_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "tbb/enumerable_thread_specific.h"
+
+#include "Rtypes.h"
+
+namespace ROOT {
+
+namespace internal {
+
+/**
+ * TASK TIMELINE
+ *
+ * Records, per worker thread, when each range of entries was processed and
+ * how the time went: opening the file and building the thread's reader
+ * (once per thread and file), reading and decoding baskets, and running
+ * the chain.  On the TTreeReader path the two are interleaved event by
+ * event and recorded as one "read+compute" span.  Spans nest inside the
+ * "task" span of their range, which carries the file and entry range.
+ *
+ * write() dumps the spans in the Chrome trace event format, which
+ * chrome://tracing and Perfetto display as one track per thread, so idle
+ * gaps between tasks and stragglers at the end of a pass stand out.
+ */
+class TTaskTracer {
+    typedef std::chrono::steady_clock clock;
+
+  public:
+    TTaskTracer() : m_origin(clock::now()) {}
+
+    /**
+     * A span of the calling thread, from construction to destruction.  Does
+     * nothing if tracer is null, so call sites need no check.
+     */
+    class Span {
+      public:
+        Span(TTaskTracer *tracer, const char *name) : m_tracer(tracer), m_name(name) {
+            if (m_tracer) {m_begin = clock::now();}
+        }
+
+        // A task span over entries [start, end) of file.
+        Span(TTaskTracer *tracer, const char *name, const char *file, Long64_t start, Long64_t end) :
+            Span(tracer, name)
+        {
+            m_file = file;
+            m_start = start;
+            m_end = end;
+        }
+
+        ~Span() {
+            if (m_tracer) {m_tracer->record(m_name, m_file, m_start, m_end, m_begin, clock::now());}
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+      private:
+        TTaskTracer *m_tracer;
+        const char *m_name;
+        const char *m_file{nullptr};
+        Long64_t m_start{0};
+        Long64_t m_end{0};
+        clock::time_point m_begin;
+    };
+
+    /**
+     * Write the spans of all threads to fileName as Chrome trace JSON;
+     * times are in microseconds since the tracer was created.
+     */
+    void write(const std::string &fileName) const {
+        std::ofstream out(fileName);
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto &thread : m_threads) {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << thread.id
+                << ", \"args\": {\"name\": \"worker " << thread.id << "\"}}";
+            first = false;
+            for (const auto &event : thread.events) {
+                out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << thread.id
+                    << ", \"ts\": " << microseconds(event.begin) << ", \"dur\": " << microseconds(event.finish) - microseconds(event.begin);
+                if (event.task) {
+                    out << ", \"args\": {\"file\": \"" << escape(event.file) << "\", \"start\": " << event.start << ", \"end\": " << event.end << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+  private:
+    struct Event {
+        const char *name;
+        bool task;
+        std::string file;
+        Long64_t start;
+        Long64_t end;
+        clock::time_point begin;
+        clock::time_point finish;
+    };
+
+    struct Thread {
+        int id{-1};
+        std::vector<Event> events;
+    };
+
+    void record(const char *name, const char *file, Long64_t start, Long64_t end, clock::time_point begin, clock::time_point finish) {
+        Thread &thread = m_threads.local();
+        if (thread.id < 0) {thread.id = m_next_thread++;}
+        thread.events.push_back(Event{name, file != nullptr, file ? file : "", start, end, begin, finish});
+    }
+
+    double microseconds(clock::time_point when) const {
+        return std::chrono::duration<double, std::micro>(when - m_origin).count();
+    }
+
+    static std::string escape(const std::string &text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {result += '\\';}
+            result += c;
+        }
+        return result;
+    }
+
+    clock::time_point m_origin;
+    std::atomic<int> m_next_thread{0};
+    tbb::enumerable_thread_specific<Thread> m_threads;
+};
+
+}  // namespace internal
+
+}  // namespace ROOT
+
+#endif  // __TASK_TRACE_H_
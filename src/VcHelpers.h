@@ -1,6 +1,8 @@
 #ifndef __VC_HELPERS_H_
 #define __VC_HELPERS_H_
 
+#include <array>
+
 #include <Vc/Vc>
 
 #include "Helpers.h"
@@ -14,6 +16,68 @@ using floatv = Vc::float_v;
 using doublev = Vc::SimdArray<double, vector_count>;
 using intv = Vc::SimdArray<int, vector_count>;
 using uintv = Vc::SimdArray<unsigned, vector_count>;
+using shortv = Vc::SimdArray<short, vector_count>;
+using ushortv = Vc::SimdArray<unsigned short, vector_count>;
+
+/**
+ * Vc has no 64-bit integer vectors; long64v gives Long64_t lanes the
+ * interface of the Vc types (loads and stores, lane access, element-wise
+ * arithmetic, comparisons yielding a maskv) over a plain array, whose
+ * loops the compiler vectorizes.
+ */
+class long64v {
+  public:
+    typedef long long EntryType;
+    typedef maskv mask_type;
+
+    long64v() {}
+    long64v(long long value) {m_data.fill(value);}
+    template<typename U, typename Flags>
+    long64v(const U *data, Flags) {load(data);}
+
+    static constexpr std::size_t size() {return vector_count;}
+
+    template<typename U, typename... Flags>
+    void load(const U *data, Flags...) {for (std::size_t idx = 0; idx < vector_count; idx++) {m_data[idx] = data[idx];}}
+    template<typename U, typename... Flags>
+    void store(U *data, Flags...) const {for (std::size_t idx = 0; idx < vector_count; idx++) {data[idx] = m_data[idx];}}
+
+    long long operator[](std::size_t idx) const {return m_data[idx];}
+    long long &operator[](std::size_t idx) {return m_data[idx];}
+
+    long long sum() const {long long total = 0; for (auto value : m_data) {total += value;} return total;}
+    long long sum(maskv mask) const {long long total = 0; for (std::size_t idx = 0; idx < vector_count; idx++) {if (mask[idx]) {total += m_data[idx];}} return total;}
+
+    long64v operator-() const {long64v result; for (std::size_t idx = 0; idx < vector_count; idx++) {result.m_data[idx] = -m_data[idx];} return result;}
+
+#define LONG64V_BINARY(OP) \
+    friend long64v operator OP(const long64v &lhs, const long64v &rhs) { \
+      long64v result; \
+      for (std::size_t idx = 0; idx < vector_count; idx++) {result.m_data[idx] = lhs.m_data[idx] OP rhs.m_data[idx];} \
+      return result; \
+    } \
+    long64v &operator OP##=(const long64v &rhs) {return *this = *this OP rhs;}
+    LONG64V_BINARY(+) LONG64V_BINARY(-) LONG64V_BINARY(*) LONG64V_BINARY(/)
+    LONG64V_BINARY(&) LONG64V_BINARY(|) LONG64V_BINARY(^)
+#undef LONG64V_BINARY
+
+    friend long64v operator<<(const long64v &lhs, int shift) {long64v result; for (std::size_t idx = 0; idx < vector_count; idx++) {result.m_data[idx] = lhs.m_data[idx] << shift;} return result;}
+    friend long64v operator>>(const long64v &lhs, int shift) {long64v result; for (std::size_t idx = 0; idx < vector_count; idx++) {result.m_data[idx] = lhs.m_data[idx] >> shift;} return result;}
+
+#define LONG64V_COMPARE(OP) \
+    friend maskv operator OP(const long64v &lhs, const long64v &rhs) { \
+      bool lanes[vector_count]; \
+      for (std::size_t idx = 0; idx < vector_count; idx++) {lanes[idx] = lhs.m_data[idx] OP rhs.m_data[idx];} \
+      maskv result; \
+      result.load(lanes); \
+      return result; \
+    }
+    LONG64V_COMPARE(<) LONG64V_COMPARE(>) LONG64V_COMPARE(<=) LONG64V_COMPARE(>=) LONG64V_COMPARE(==) LONG64V_COMPARE(!=)
+#undef LONG64V_COMPARE
+
+  private:
+    std::array<long long, vector_count> m_data{};
+};
 
 namespace internal {
 
@@ -43,6 +107,32 @@ struct vector_type_impl<unsigned> {
   typedef uintv type;
 };
 
+template<>
+struct vector_type_impl<short> {
+  typedef shortv type;
+};
+
+template<>
+struct vector_type_impl<unsigned short> {
+  typedef ushortv type;
+};
+
+template<>
+struct vector_type_impl<long long> {
+  typedef long64v type;
+};
+
+// Vc has no 8-bit vectors: UChar_t and Bool_t lanes are widened to 16 bits.
+template<>
+struct vector_type_impl<unsigned char> {
+  typedef ushortv type;
+};
+
+template<>
+struct vector_type_impl<bool> {
+  typedef ushortv type;
+};
+
 ///
 // With this convenience type, a user can determine the type
 // of an equivalent vector type by doing:
@@ -52,6 +142,21 @@ struct vector_type_impl<unsigned> {
 template<typename T>
 using vector_t = typename vector_type_impl<T>::type;
 
+///
+// Per-lane access to a vector type: the scalar type of each lane and
+// how to load a full vector from scalars.
+template<typename V>
+struct vector_lanes {
+  typedef typename V::EntryType type;
+  static void load(V &vec, const type *data) {vec.load(data, Vc::Unaligned);}
+};
+
+template<typename T, std::size_t N>
+struct vector_lanes<std::array<T, N>> {
+  typedef T type;
+  static void load(std::array<T, N> &vec, const type *data) {std::copy(data, data + N, vec.begin());}
+};
+
 ///
 // Simple SFINAE to determine whether a given function can be applied against
 // the vector equivalent of the given arguments.
@@ -149,6 +254,90 @@ class vectorized_tuple_helper<I, I, ArgTuple, VArgs...> {
 template<typename ArgTuple>
 using vectorized_tuple_t = typename vectorized_tuple_helper<0, std::tuple_size<ArgTuple>::value, ArgTuple>::type;
 
+///
+// Determine whether a tuple is already part of a vectorized stream; i.e.,
+// whether it starts with the lane mask.
+template<typename Tuple>
+struct is_vectorized_tuple : std::false_type {};
+
+template<typename... Args>
+struct is_vectorized_tuple<std::tuple<maskv, Args...>> : std::true_type {};
+
+///
+// The scalar equivalent of a vectorized tuple:
+//
+// std::tuple<maskv, floatv, intv> -> std::tuple<float, int>
+template<typename VTuple>
+struct scalar_tuple_helper;
+
+template<typename... VArgs>
+struct scalar_tuple_helper<std::tuple<maskv, VArgs...>> {
+  typedef std::tuple<typename vector_lanes<VArgs>::type...> type;
+};
+
+template<typename VTuple>
+using scalar_tuple_t = typename scalar_tuple_helper<VTuple>::type;
+
+///
+// Determine whether a function can be called with the elements of a tuple.
+template<typename F, typename Tuple>
+class is_callable_with_tuple;
+
+template<typename F, typename... Args>
+class is_callable_with_tuple<F, std::tuple<Args...>> {
+  private:
+    typedef char yes[1];
+    typedef char no[2];
+
+    template <typename F2>
+    static yes & test(typename std::result_of<F2(Args...)>::type *);
+
+    template <typename>
+    static no  & test(...);
+
+  public:
+    static const bool value = sizeof(test<F>(0)) == sizeof(yes);
+};
+
+///
+// Vectorized mappers must keep the lane mask at the front of their output
+// so that later stages know which lanes are valid.  with_mask prepends the
+// input mask to a mapper's result; if the mapper returned its own mask, the
+// two are ANDed (a mapper cannot revive a lane that was filtered out).
+template<typename... Args>
+std::tuple<maskv, Args...>
+with_mask(maskv mask, std::tuple<Args...> result) {
+  return std::tuple_cat(std::make_tuple(mask), std::move(result));
+}
+
+template<typename... Args>
+std::tuple<maskv, Args...>
+with_mask(maskv mask, std::tuple<maskv, Args...> result) {
+  std::get<0>(result) = mask && std::get<0>(result);
+  return result;
+}
+
+template<typename T>
+std::tuple<maskv, T>
+with_mask(maskv mask, T result) {
+  return std::make_tuple(mask, std::move(result));
+}
+
+template<typename T>
+using vectorized_result_t = decltype(with_mask(std::declval<maskv>(), std::declval<T>()));
+
+///
+// Convert the result of a vectorized filter to the stream's mask type.
+inline maskv to_maskv(maskv mask) {return mask;}
+inline maskv to_maskv(bool pass) {return maskv(pass);}
+
+template<typename Mask>
+maskv to_maskv(const Mask &mask) {return Vc::simd_cast<maskv>(mask);}
+
+// The reverse: the lane mask of a stream, as a mask for vector type V.
+template<typename V>
+typename V::mask_type from_maskv(maskv mask) {return Vc::simd_cast<typename V::mask_type>(mask);}
+
 ///
 // Given a processing chain, determine the input type for the first argument.
 
@@ -23,6 +23,8 @@ class TTreeProcessorMapperLambda;
 template<typename T, typename... InputArgs>
 class TTreeProcessorMapperLambda<0, T, InputArgs...> final : public TTreeProcessorMapper<typename std::result_of<T(InputArgs...)>::type, InputArgs...> {
   public:
+    typedef T callable_type;
+
     TTreeProcessorMapperLambda(const T& fn) : m_fn(fn) {}
 
     typename std::result_of<T(InputArgs...)>::type map (InputArgs ...args) const noexcept {
@@ -33,13 +35,14 @@ class TTreeProcessorMapperLambda<0, T, InputArgs...> final : public TTreeProcess
     T m_fn;
 };
 
+// Vectorized mappers re-attach the lane mask to the lambda's output.
 template<typename T, typename... InputArgs>
-class TTreeProcessorMapperLambda<1, T, InputArgs...> final : public TTreeProcessorMapper<typename std::result_of<T(InputArgs...)>::type, InputArgs...> {
+class TTreeProcessorMapperLambda<1, T, maskv, InputArgs...> final : public TTreeProcessorMapper<vectorized_result_t<typename std::result_of<T(maskv, InputArgs...)>::type>, maskv, InputArgs...> {
   public:
     TTreeProcessorMapperLambda(const T& fn) : m_fn(fn) {}
 
-    typename std::result_of<T(InputArgs...)>::type map (InputArgs ...args) const noexcept {
-      return m_fn(args...);
+    vectorized_result_t<typename std::result_of<T(maskv, InputArgs...)>::type> map (maskv mask, InputArgs ...args) const noexcept {
+      return with_mask(mask, m_fn(mask, args...));
     }
 
   private:
@@ -55,6 +58,8 @@ class TTreeProcessorFilterLambda;
 template<typename T, typename... InputArgs>
 class TTreeProcessorFilterLambda<0, T, InputArgs...> final : public TTreeProcessorFilter<InputArgs...> {
   public:
+    typedef T callable_type;
+
     TTreeProcessorFilterLambda(const T& fn) : m_fn(fn) {}
 
     bool filter(InputArgs ...args) const noexcept {
@@ -65,13 +70,14 @@ class TTreeProcessorFilterLambda<0, T, InputArgs...> final : public TTreeProcess
     T m_fn;
 };
 
+// Vectorized filters return the mask of lanes that pass.
 template<typename T, typename... InputArgs>
-class TTreeProcessorFilterLambda<1, T, InputArgs...> final : public TTreeProcessorFilter<internal::vector_t<InputArgs>...> {
+class TTreeProcessorFilterLambda<1, T, maskv, InputArgs...> final : public TTreeProcessorFilter<maskv, InputArgs...> {
   public:
     TTreeProcessorFilterLambda(const T& fn) : m_fn(fn) {}
 
-    bool filter(internal::vector_t<InputArgs> ...args) const noexcept {
-      return m_fn(args...);
+    maskv filter(maskv mask, InputArgs ...args) const noexcept {
+      return to_maskv(m_fn(mask, args...));
     }
 
   private:
@@ -84,40 +90,870 @@ class TTreeProcessorFilterLambda<1, T, InputArgs...> final : public TTreeProcess
  * Prints the final number out at the end.
  */
 template<typename... InputArgs>
-class TTreeProcessorCountPrinter final : public TTreeProcessorMapper<std::tuple<InputArgs...>, InputArgs...> {
-  typedef tbb::enumerable_thread_specific<int> EventCounter;
+class TTreeProcessorCountPrinter final : public TTreeProcessorMapper<std::tuple<InputArgs...>, InputArgs...>, public TTreeProcessorThreadLocal {
 
   public:
-    TTreeProcessorCountPrinter() : m_counter(0) {
+    TTreeProcessorCountPrinter() {}
+
+    TTreeProcessorCountPrinter(TTreeProcessorCountPrinter && rhs) : m_counter(rhs.m_counter) {}
+
+    // Per-thread clones start counting from zero.
+    TTreeProcessorCountPrinter(const TTreeProcessorCountPrinter &) {}
+
+    std::tuple<InputArgs...> map (InputArgs... args) const noexcept {
+      m_counter++;
+
+      return std::make_tuple(args...);
     }
 
-    TTreeProcessorCountPrinter(TTreeProcessorCountPrinter && rhs) {
-      m_counter = std::move(rhs.m_counter);
+    void merge(const TTreeProcessorCountPrinter &clone) {
+      m_counter += clone.m_counter;
     }
 
-    TTreeProcessorCountPrinter(const TTreeProcessorCountPrinter & rhs) {
-      int sum = std::accumulate(rhs.m_counter.begin(), rhs.m_counter.end(), 0);
-      m_counter = EventCounter(sum);
+    bool finalize() {
+      std::cout << "Counter saw " << m_counter << " events.\n";
+      return true;
     }
 
-    std::tuple<InputArgs...> map (InputArgs... args) const noexcept {
-      //EventCounter::reference my_counter = m_counter->local();
-      //++m_counter->local();
-      m_counter.local()++;
+  private:
+    mutable long m_counter{0};
+};
 
-      return std::make_tuple(args...);
+template<typename InputTuple>
+struct count_printer_type;
+
+template<typename... InputArgs>
+struct count_printer_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorCountPrinter<InputArgs...> type;
+};
+
+/**
+ * The filter added by filterRange<I>(): passes events whose input I lies
+ * in [lo, hi].  The other inputs are declared ROOT::unused, so with late
+ * materialization only branch I is read before the filter runs.
+ */
+template<std::size_t I, typename InputTuple, typename Indices = std::make_index_sequence<std::tuple_size<InputTuple>::value>>
+class TTreeProcessorRangeFilter;
+
+template<std::size_t I, typename... InputArgs, std::size_t... J>
+class TTreeProcessorRangeFilter<I, std::tuple<InputArgs...>, std::index_sequence<J...>> final : public TTreeProcessorFilter<InputArgs...> {
+  typedef typename std::tuple_element<I, std::tuple<InputArgs...>>::type value_type;
+  static_assert(std::is_arithmetic<value_type>::value, "filterRange() requires a numeric branch.");
+
+  public:
+    TTreeProcessorRangeFilter(double lo, double hi) : m_lo(lo), m_hi(hi) {}
+
+    bool filter(std::conditional_t<J == I, value_type, ROOT::unused>... args) const noexcept {
+      double value = std::get<I>(std::forward_as_tuple(args...));
+      return value >= m_lo && value <= m_hi;
+    }
+
+  private:
+    double m_lo;
+    double m_hi;
+};
+
+template<std::size_t I, typename InputTuple>
+struct range_filter_type {
+  typedef TTreeProcessorRangeFilter<I, InputTuple> type;
+};
+
+/**
+ * Holds the per-thread clones of a stage for the duration of one
+ * process call.  For stages that are not thread-local this is empty and
+ * the original stage is used directly.
+ */
+template<typename T, bool IsThreadLocal = is_thread_local_stage<T>::value>
+class TTreeProcessorStageClones;
+
+template<typename T>
+class TTreeProcessorStageClones<T, false> {
+  public:
+    TTreeProcessorStageClones(T &) {}
+
+    T &local(T &stage) {return stage;}
+
+    void merge(T &) {}
+};
+
+template<typename T>
+class TTreeProcessorStageClones<T, true> {
+  public:
+    // Clones are copied from the stage as it is when processing starts.
+    TTreeProcessorStageClones(T &stage) : m_clones(static_cast<const T&>(stage)) {}
+
+    T &local(T &) {return m_clones.local();}
+
+    // Clones are merged pairwise, in parallel, in log2(threads) rounds; the
+    // last one left is merged into the stage.
+    void merge(T &stage) {
+      std::vector<T*> partials;
+      for (auto &clone : m_clones) {partials.push_back(&clone);}
+      for (std::size_t stride = 1; stride < partials.size(); stride *= 2) {
+        tbb::parallel_for(std::size_t(0), partials.size() - stride, 2*stride, [&](std::size_t idx) {
+          partials[idx]->merge(*partials[idx + stride]);
+        });
+      }
+      if (!partials.empty()) {stage.merge(*partials[0]);}
+      m_clones.clear();
+    }
+
+  private:
+    tbb::enumerable_thread_specific<T, tbb::cache_aligned_allocator<T>, tbb::ets_key_per_instance> m_clones;
+};
+
+/**
+ * Accumulates individual lanes and packs them into vectorized tuples.
+ * Shared by the stages that (re)build vectors: compactors and packers.
+ */
+template<typename... VArgs>
+class TTreeProcessorLaneBuffer {
+  public:
+    typedef std::tuple<maskv, VArgs...> tuple_type;
+
+    /**
+     * Buffer one lane; returns true once a full vector is available.
+     */
+    bool append(const typename vector_lanes<VArgs>::type &... values) {
+      store(std::index_sequence_for<VArgs...>(), values...);
+      return ++m_fill == vector_count;
+    }
+
+    unsigned int size() const {return m_fill;}
+
+    /**
+     * Pack the buffered lanes (masking off the rest) and empty the buffer.
+     */
+    tuple_type pack() {
+      return pack_helper(std::index_sequence_for<VArgs...>());
+    }
+
+  private:
+    template<std::size_t... I>
+    void store(std::index_sequence<I...>, const typename vector_lanes<VArgs>::type &... values) {
+      bool ignore_array[] = { true, (std::get<I>(m_lanes)[m_fill] = values, true)... };
+      (void) ignore_array;
+    }
+
+    template<std::size_t... I>
+    tuple_type pack_helper(std::index_sequence<I...>) {
+      tuple_type output;
+      std::get<0>(output) = floatv::IndexesFromZero() < floatv(static_cast<float>(m_fill));
+      bool ignore_array[] = { true, (vector_lanes<VArgs>::load(std::get<I+1>(output), std::get<I>(m_lanes).data()), true)... };
+      (void) ignore_array;
+      m_fill = 0;
+      return output;
+    }
+
+    std::tuple<std::array<typename vector_lanes<VArgs>::type, vector_count>...> m_lanes;
+    unsigned int m_fill{0};
+};
+
+/**
+ * Repacks a vectorized stream after selective filters.
+ *
+ * Valid lanes of each incoming vector are buffered (per thread) until a full
+ * vector's worth has accumulated, which is then passed downstream with a
+ * full mask.  At the end of each entry range the processor calls flush(),
+ * emitting the remaining lanes with a partial mask.  Prints the achieved
+ * lane occupancy at the end.
+ */
+template<typename... InputArgs>
+class TTreeProcessorCompactor;
+
+template<typename... VArgs>
+class TTreeProcessorCompactor<maskv, VArgs...> final : public TTreeProcessorEmitterBase {
+  struct Buffer {
+    TTreeProcessorLaneBuffer<VArgs...> m_lanes;
+    Long64_t m_vectors_in{0};
+    Long64_t m_vectors_out{0};
+    Long64_t m_lanes_in{0};
+  };
+  typedef tbb::enumerable_thread_specific<Buffer> BufferSet;
+
+  public:
+    typedef std::tuple<maskv, VArgs...> output_type;
+
+    TTreeProcessorCompactor() {}
+
+    TTreeProcessorCompactor(TTreeProcessorCompactor && rhs) : m_buffers(std::move(rhs.m_buffers)) {}
+
+    TTreeProcessorCompactor(const TTreeProcessorCompactor &) = delete;
+
+    template<typename Emit>
+    void push(const output_type &input, Emit &&emit) const {
+      Buffer &buf = m_buffers.local();
+      const maskv &mask = std::get<0>(input);
+      buf.m_vectors_in++;
+      // Nothing to repack; pass the vector through untouched.
+      if (!buf.m_lanes.size() && mask.isFull()) {
+        buf.m_lanes_in += vector_count;
+        buf.m_vectors_out++;
+        emit(input);
+        return;
+      }
+      for (unsigned int idx=0; idx<vector_count; idx++) {
+        if (!mask[idx]) {continue;}
+        buf.m_lanes_in++;
+        if (append_lane(buf, input, idx, std::index_sequence_for<VArgs...>())) {
+          buf.m_vectors_out++;
+          emit(buf.m_lanes.pack());
+        }
+      }
+    }
+
+    template<typename Emit>
+    void flush(Emit &&emit) const {
+      Buffer &buf = m_buffers.local();
+      if (buf.m_lanes.size()) {
+        buf.m_vectors_out++;
+        emit(buf.m_lanes.pack());
+      }
     }
 
     bool finalize() {
-      int sum = std::accumulate(m_counter.begin(), m_counter.end(), 0);
-      //int sum = m_counter->combine([](int x, int y) {return x+y;});
-      std::cout << "Counter saw " << sum << " events.\n";
+      Long64_t vectors_in = 0, vectors_out = 0, lanes = 0;
+      for (const auto &buf : m_buffers) {
+        vectors_in += buf.m_vectors_in;
+        vectors_out += buf.m_vectors_out;
+        lanes += buf.m_lanes_in;
+      }
+      std::cout << "Compactor repacked " << lanes << " lanes from " << vectors_in << " vectors into " << vectors_out << " vectors";
+      if (vectors_in && vectors_out) {
+        std::cout << " (occupancy " << 100.0*lanes/(vectors_in*vector_count) << "% -> " << 100.0*lanes/(vectors_out*vector_count) << "%)";
+      }
+      std::cout << ".\n";
+      return true;
+    }
+
+  private:
+    template<std::size_t... I>
+    static bool append_lane(Buffer &buf, const output_type &input, unsigned int idx, std::index_sequence<I...>) {
+      return buf.m_lanes.append(std::get<I+1>(input)[idx]...);
+    }
+
+    mutable BufferSet m_buffers;
+};
+
+template<typename InputTuple>
+struct compactor_type;
+
+template<typename... InputArgs>
+struct compactor_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorCompactor<InputArgs...> type;
+};
+
+/**
+ * Switches a scalar stream to a vectorized one: events are buffered
+ * (per thread) into lanes and passed on a full vector at a time; flush()
+ * emits the partially-filled vector at the end of each entry range.
+ *
+ * Inserted automatically in front of a vectorized stage that follows a
+ * scalar one.
+ */
+template<typename... InputArgs>
+class TTreeProcessorPacker final : public TTreeProcessorEmitterBase {
+  typedef TTreeProcessorLaneBuffer<vector_t<InputArgs>...> Buffer;
+
+  public:
+    typedef vectorized_tuple_t<std::tuple<InputArgs...>> output_type;
+
+    TTreeProcessorPacker() {}
+
+    TTreeProcessorPacker(TTreeProcessorPacker && rhs) : m_buffers(std::move(rhs.m_buffers)) {}
+
+    TTreeProcessorPacker(const TTreeProcessorPacker &) = delete;
+
+    template<typename Emit>
+    void push(const std::tuple<InputArgs...> &input, Emit &&emit) const {
+      Buffer &buf = m_buffers.local();
+      if (append_event(buf, input, std::index_sequence_for<InputArgs...>())) {
+        emit(buf.pack());
+      }
+    }
+
+    template<typename Emit>
+    void flush(Emit &&emit) const {
+      Buffer &buf = m_buffers.local();
+      if (buf.size()) {
+        emit(buf.pack());
+      }
+    }
+
+    bool finalize() {return true;}
+
+  private:
+    template<std::size_t... I>
+    static bool append_event(Buffer &buf, const std::tuple<InputArgs...> &input, std::index_sequence<I...>) {
+      return buf.append(std::get<I>(input)...);
+    }
+
+    mutable tbb::enumerable_thread_specific<Buffer> m_buffers;
+};
+
+/**
+ * Switches a vectorized stream to a scalar one: each valid lane is passed
+ * on as its own event.
+ *
+ * Inserted automatically in front of a scalar-only stage that follows a
+ * vectorized one.
+ */
+template<typename... InputArgs>
+class TTreeProcessorUnpacker;
+
+template<typename... VArgs>
+class TTreeProcessorUnpacker<maskv, VArgs...> final : public TTreeProcessorEmitterBase {
+  public:
+    typedef std::tuple<maskv, VArgs...> input_type;
+    typedef scalar_tuple_t<input_type> output_type;
+
+    TTreeProcessorUnpacker() {}
+    TTreeProcessorUnpacker(TTreeProcessorUnpacker &&) = default;
+    TTreeProcessorUnpacker(const TTreeProcessorUnpacker &) = delete;
+
+    template<typename Emit>
+    void push(const input_type &input, Emit &&emit) const {
+      const maskv &mask = std::get<0>(input);
+      for (unsigned int idx=0; idx<vector_count; idx++) {
+        if (mask[idx]) {
+          emit(lane(input, idx, std::index_sequence_for<VArgs...>()));
+        }
+      }
+    }
+
+    template<typename Emit>
+    void flush(Emit &&) const {}
+
+    bool finalize() {return true;}
+
+  private:
+    template<std::size_t... I>
+    static output_type lane(const input_type &input, unsigned int idx, std::index_sequence<I...>) {
+      return output_type(std::get<I+1>(input)[idx]...);
+    }
+};
+
+template<typename InputTuple>
+struct packer_type;
+
+template<typename... InputArgs>
+struct packer_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorPacker<InputArgs...> type;
+};
+
+template<typename InputTuple>
+struct unpacker_type;
+
+template<typename... InputArgs>
+struct unpacker_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorUnpacker<InputArgs...> type;
+};
+
+/**
+ * The callback handed to a flatMap lambda: each call builds one Output
+ * tuple from its arguments and passes it straight downstream.
+ */
+template<typename Output, typename Emit>
+class TTreeProcessorFlatMapOutput {
+  public:
+    TTreeProcessorFlatMapOutput(Emit &emit) : m_emit(emit) {}
+
+    template<typename... Args>
+    void operator()(Args &&... args) const {
+      m_emit(Output(std::forward<Args>(args)...));
     }
 
   private:
-    mutable EventCounter m_counter;
+    Emit &m_emit;
 };
 
+/**
+ * An emitter derived from a user-provided flatMap lambda: the lambda takes
+ * the input followed by an output callback, and calls the callback once per
+ * tuple it emits (possibly not at all).  Nothing is buffered.
+ */
+template<typename Output, typename T, typename... InputArgs>
+class TTreeProcessorFlatMapperLambda final : public TTreeProcessorEmitterBase {
+  public:
+    typedef Output output_type;
+
+    TTreeProcessorFlatMapperLambda(const T &fn) : m_fn(fn) {}
+
+    template<typename Emit>
+    void push(const std::tuple<InputArgs...> &input, Emit &&emit) const {
+      TTreeProcessorFlatMapOutput<Output, std::remove_reference_t<Emit>> output(emit);
+      push_helper(input, output, std::index_sequence_for<InputArgs...>());
+    }
+
+    template<typename Emit>
+    void flush(Emit &&) const {}
+
+    bool finalize() {return true;}
+
+  private:
+    template<typename Callback, std::size_t... I>
+    void push_helper(const std::tuple<InputArgs...> &input, Callback &output, std::index_sequence<I...>) const {
+      m_fn(std::get<I>(input)..., output);
+    }
+
+    T m_fn;
+};
+
+template<typename Output, typename T, typename InputTuple>
+struct flat_mapper_type;
+
+template<typename Output, typename T, typename... InputArgs>
+struct flat_mapper_type<Output, T, std::tuple<InputArgs...>> {
+  typedef TTreeProcessorFlatMapperLambda<Output, T, InputArgs...> type;
+};
+
+/**
+ * Folds every event into a single value: value = combine(value, args...).
+ *
+ * Each worker thread folds into its own clone, starting from init; the
+ * per-thread partial values are then combined with combine(value, value).
+ * init must therefore be an identity of combine, and combine must be
+ * associative and commutative.
+ */
+template<unsigned int IsVectorized, typename T, typename Combine, typename... InputArgs>
+class TTreeProcessorReducer;
+
+template<typename T, typename Combine, typename... InputArgs>
+class TTreeProcessorReducer<0, T, Combine, InputArgs...> final : public TTreeProcessorMapper<std::tuple<>, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef T result_type;
+
+    TTreeProcessorReducer(const T &init, const Combine &combine) : m_init(init), m_value(init), m_combine(combine) {}
+    TTreeProcessorReducer(TTreeProcessorReducer &&) = default;
+    // Per-thread clones start from init.
+    TTreeProcessorReducer(const TTreeProcessorReducer &rhs) : m_init(rhs.m_init), m_value(rhs.m_init), m_combine(rhs.m_combine) {}
+
+    std::tuple<> map(InputArgs... args) const noexcept {
+      m_value = m_combine(m_value, args...);
+      return std::tuple<>();
+    }
+
+    void merge(const TTreeProcessorReducer &clone) {m_value = m_combine(m_value, clone.m_value);}
+
+    // Returns the result of the last process call and starts over.
+    result_type result() {
+      T value = m_value;
+      m_value = m_init;
+      return value;
+    }
+
+  private:
+    T m_init;
+    mutable T m_value;
+    Combine m_combine;
+};
+
+// Vectorized reducers keep one partial value per lane; masked-off lanes are
+// left untouched.  The lanes are combined when the result is requested.
+template<typename T, typename Combine, typename... InputArgs>
+class TTreeProcessorReducer<1, T, Combine, maskv, InputArgs...> final : public TTreeProcessorMapper<std::tuple<>, maskv, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef T result_type;
+
+    TTreeProcessorReducer(const T &init, const Combine &combine) : m_init(init), m_value(init), m_combine(combine) {}
+    TTreeProcessorReducer(TTreeProcessorReducer &&) = default;
+    TTreeProcessorReducer(const TTreeProcessorReducer &rhs) : m_init(rhs.m_init), m_value(rhs.m_init), m_combine(rhs.m_combine) {}
+
+    std::tuple<> map(maskv mask, InputArgs... args) const noexcept {
+      m_value(from_maskv<vector_t<T>>(mask)) = m_combine(m_value, args...);
+      return std::tuple<>();
+    }
+
+    void merge(const TTreeProcessorReducer &clone) {m_value = m_combine(m_value, clone.m_value);}
+
+    result_type result() {
+      T value = m_init;
+      for (unsigned int idx=0; idx<vector_count; idx++) {value = m_combine(value, static_cast<T>(m_value[idx]));}
+      m_value = vector_t<T>(m_init);
+      return value;
+    }
+
+  private:
+    T m_init;
+    mutable vector_t<T> m_value;
+    Combine m_combine;
+};
+
+/**
+ * Feeds every event to a user accumulator: acc(args...).
+ *
+ * Each worker thread gets a copy of the accumulator as passed to
+ * aggregate(); the copies are combined with acc.merge(other) and the
+ * merged accumulator is the result.  On a vectorized stream the
+ * accumulator receives the lane mask as its first argument.
+ */
+template<typename Acc, typename... InputArgs>
+class TTreeProcessorAggregator final : public TTreeProcessorMapper<std::tuple<>, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef Acc result_type;
+
+    TTreeProcessorAggregator(const Acc &acc) : m_init(acc), m_acc(acc) {}
+    TTreeProcessorAggregator(TTreeProcessorAggregator &&) = default;
+    TTreeProcessorAggregator(const TTreeProcessorAggregator &rhs) : m_init(rhs.m_init), m_acc(rhs.m_init) {}
+
+    std::tuple<> map(InputArgs... args) const noexcept {
+      m_acc(args...);
+      return std::tuple<>();
+    }
+
+    void merge(const TTreeProcessorAggregator &clone) {m_acc.merge(clone.m_acc);}
+
+    // Returns the accumulator of the last process call and starts over.
+    result_type result() {
+      Acc acc = m_acc;
+      m_acc = m_init;
+      return acc;
+    }
+
+  private:
+    Acc m_init;
+    mutable Acc m_acc;
+};
+
+template<unsigned int IsVectorized, typename T, typename Combine, typename InputTuple>
+struct reducer_type;
+
+template<unsigned int IsVectorized, typename T, typename Combine, typename... InputArgs>
+struct reducer_type<IsVectorized, T, Combine, std::tuple<InputArgs...>> {
+  typedef TTreeProcessorReducer<IsVectorized, T, Combine, InputArgs...> type;
+};
+
+template<typename Acc, typename InputTuple>
+struct aggregator_type;
+
+template<typename Acc, typename... InputArgs>
+struct aggregator_type<Acc, std::tuple<InputArgs...>> {
+  typedef TTreeProcessorAggregator<Acc, InputArgs...> type;
+};
+
+/**
+ * The terminal stage added by snapshot(): writes every event as an entry
+ * of a new tree, one branch per element of the input.
+ *
+ * Each worker thread fills its own tree, kept in an in-memory file handed
+ * out by a TBufferMerger.  Every autoFlush entries, and once the thread's
+ * clone is merged, the thread's baskets are queued to the merger, which
+ * appends them to the output file; threads never share a tree nor wait for
+ * each other to write.  Entries of different threads are interleaved in
+ * the output in no particular order.  process / processParallel return the
+ * number of entries written.
+ */
+template<typename... InputArgs>
+class TTreeProcessorSnapshot final : public TTreeProcessorMapper<std::tuple<>, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef Long64_t result_type;
+    typedef typename convert_to_strings<std::tuple<InputArgs...>>::type branch_names_type;
+
+    TTreeProcessorSnapshot(const std::string &treeName, const std::string &fileName, const branch_names_type &branchNames, Long64_t autoFlush) :
+      m_output(std::make_shared<Output>(treeName, fileName, autoFlush)),
+      m_branch_names(branchNames)
+    {}
+    TTreeProcessorSnapshot(TTreeProcessorSnapshot &&) = default;
+    // Per-thread clones share the output; each opens its own tree.
+    TTreeProcessorSnapshot(const TTreeProcessorSnapshot &rhs) : m_output(rhs.m_output), m_branch_names(rhs.m_branch_names) {}
+
+    std::tuple<> map(InputArgs... args) const {
+      if (!m_tree) {open();}
+      m_values = std::tuple<std::decay_t<InputArgs>...>(args...);
+      m_tree->Fill();
+      if (++m_entries % m_output->autoFlush == 0) {m_file->Write();}
+      return std::tuple<>();
+    }
+
+    void merge(const TTreeProcessorSnapshot &clone) {
+      clone.close();
+      m_entries += clone.m_entries;
+    }
+
+    // Writes out the output file; it holds an empty tree if no event passed.
+    bool finalize() {
+      if (!m_output->opened()) {
+        open();
+        m_file->Write();
+      }
+      close();
+      m_output->close();
+      return true;
+    }
+
+    // Returns the number of entries written by the last process call.
+    result_type result() {
+      Long64_t entries = m_entries;
+      m_entries = 0;
+      return entries;
+    }
+
+  private:
+    // State shared by the clones: the merger, created when the first clone
+    // opens its tree and closed (writing the output) by finalize().
+    struct Output {
+      Output(const std::string &treeName_, const std::string &fileName_, Long64_t autoFlush_) :
+        treeName(treeName_), fileName(fileName_), autoFlush(autoFlush_)
+      {}
+
+      std::shared_ptr<ROOT::Experimental::TBufferMergerFile> file() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!merger) {merger.reset(new ROOT::Experimental::TBufferMerger(fileName.c_str(), "RECREATE"));}
+        return merger->GetFile();
+      }
+
+      bool opened() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<bool>(merger);
+      }
+
+      void close() {merger.reset();}
+
+      std::string treeName;
+      std::string fileName;
+      Long64_t autoFlush;
+      std::mutex mutex;
+      std::unique_ptr<ROOT::Experimental::TBufferMerger> merger;
+    };
+
+    void open() const {
+      m_file = m_output->file();
+      TDirectory::TContext context(m_file.get());
+      m_tree.reset(new TTree(m_output->treeName.c_str(), m_output->treeName.c_str()));
+      m_tree->SetAutoFlush(m_output->autoFlush);
+      branch_helper(std::index_sequence_for<InputArgs...>());
+    }
+
+    template<std::size_t... I>
+    void branch_helper(std::index_sequence<I...>) const {
+      bool ignore_array[] = {false, (m_tree->Branch(std::get<I>(m_branch_names).c_str(), &std::get<I>(m_values)), false)...};
+      (void)ignore_array;
+    }
+
+    // Queue what is left of this clone's tree to the merger.
+    void close() const {
+      if (!m_tree) {return;}
+      if (m_tree->GetEntries()) {m_file->Write();}
+      m_tree.reset();
+      m_file.reset();
+    }
+
+    std::shared_ptr<Output> m_output;
+    branch_names_type m_branch_names;
+    mutable std::shared_ptr<ROOT::Experimental::TBufferMergerFile> m_file;
+    mutable std::unique_ptr<TTree> m_tree;
+    mutable std::tuple<std::decay_t<InputArgs>...> m_values;
+    mutable Long64_t m_entries{0};
+};
+
+template<typename InputTuple>
+struct snapshot_type;
+
+template<typename... InputArgs>
+struct snapshot_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorSnapshot<InputArgs...> type;
+};
+
+/**
+ * The terminal stage added by collect(): gathers the events into one
+ * column (std::vector) per element of the input, in entry order.
+ *
+ * Before running the chain over a range of entries, the processor calls
+ * begin_range(); the range's events go into a chunk of their own, reserved
+ * to the size of the range, so worker threads never share storage nor grow
+ * a common buffer.  Once processing is done the chunks are sorted by input
+ * file (in the order given to process) and first entry, and copied, in
+ * parallel, into columns allocated once at their final size.
+ */
+template<typename... InputArgs>
+class TTreeProcessorCollector final : public TTreeProcessorMapper<std::tuple<>, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef std::tuple<std::vector<std::decay_t<InputArgs>>...> result_type;
+
+    TTreeProcessorCollector() {}
+    TTreeProcessorCollector(TTreeProcessorCollector &&) = default;
+    // Per-thread clones start without chunks.
+    TTreeProcessorCollector(const TTreeProcessorCollector &rhs) : m_inputs(rhs.m_inputs) {}
+
+    /**
+     * The inputs of the coming process call, in order; chunks are ordered
+     * by position of their file in this list.
+     */
+    void set_inputs(const std::vector<std::string> &inputs) {m_inputs = inputs;}
+
+    // Start a chunk for the events of entries [start, end) of file.
+    void begin_range(const std::string &file, Long64_t start, Long64_t end) {
+      m_chunks.emplace_back(file, start);
+      reserve_helper(m_chunks.back().columns, end - start, std::index_sequence_for<InputArgs...>());
+    }
+
+    std::tuple<> map(InputArgs... args) const {
+      if (m_chunks.empty()) {m_chunks.emplace_back(std::string(), 0);}
+      push_helper(m_chunks.back().columns, std::index_sequence_for<InputArgs...>(), args...);
+      return std::tuple<>();
+    }
+
+    void merge(const TTreeProcessorCollector &clone) {
+      for (auto &chunk : clone.m_chunks) {
+          if (chunk_size(chunk)) {m_chunks.push_back(std::move(chunk));}
+      }
+      clone.m_chunks.clear();
+    }
+
+    bool finalize() {
+      std::vector<std::pair<std::size_t, Long64_t>> keys;
+      for (const auto &chunk : m_chunks) {
+          keys.emplace_back(std::find(m_inputs.begin(), m_inputs.end(), chunk.file) - m_inputs.begin(), chunk.start);
+      }
+      std::vector<std::size_t> order(m_chunks.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) {return keys[lhs] < keys[rhs];});
+
+      std::vector<std::size_t> offsets(1, 0);
+      for (std::size_t idx : order) {offsets.push_back(offsets.back() + chunk_size(m_chunks[idx]));}
+      resize_helper(m_result, offsets.back(), std::index_sequence_for<InputArgs...>());
+      tbb::parallel_for(std::size_t(0), order.size(), [&](std::size_t idx) {
+          copy_helper(m_chunks[order[idx]].columns, offsets[idx], std::index_sequence_for<InputArgs...>());
+      });
+      m_chunks.clear();
+      return true;
+    }
+
+    // Returns the columns of the last process call and starts over.
+    result_type result() {
+      result_type columns;
+      std::swap(columns, m_result);
+      return columns;
+    }
+
+  private:
+    struct Chunk {
+      Chunk(const std::string &file_, Long64_t start_) : file(file_), start(start_) {}
+
+      std::string file;
+      Long64_t start;
+      result_type columns;
+    };
+
+    static std::size_t chunk_size(const Chunk &chunk) {return std::get<0>(chunk.columns).size();}
+
+    template<std::size_t... I>
+    static void reserve_helper(result_type &columns, std::size_t size, std::index_sequence<I...>) {
+      bool ignore_array[] = {false, (std::get<I>(columns).reserve(size), false)...};
+      (void)ignore_array;
+    }
+
+    template<std::size_t... I>
+    static void push_helper(result_type &columns, std::index_sequence<I...>, InputArgs... args) {
+      bool ignore_array[] = {false, (std::get<I>(columns).push_back(args), false)...};
+      (void)ignore_array;
+    }
+
+    template<std::size_t... I>
+    static void resize_helper(result_type &columns, std::size_t size, std::index_sequence<I...>) {
+      bool ignore_array[] = {false, (std::get<I>(columns).resize(size), false)...};
+      (void)ignore_array;
+    }
+
+    template<std::size_t... I>
+    void copy_helper(const result_type &columns, std::size_t offset, std::index_sequence<I...>) {
+      bool ignore_array[] = {false, (std::copy(std::get<I>(columns).begin(), std::get<I>(columns).end(), std::get<I>(m_result).begin() + offset), false)...};
+      (void)ignore_array;
+    }
+
+    std::vector<std::string> m_inputs;
+    mutable std::vector<Chunk> m_chunks;
+    result_type m_result;
+};
+
+template<typename InputTuple>
+struct collector_type;
+
+template<typename... InputArgs>
+struct collector_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorCollector<InputArgs...> type;
+};
+
+template<typename T>
+struct is_collector : std::false_type {};
+
+template<typename... InputArgs>
+struct is_collector<TTreeProcessorCollector<InputArgs...>> : std::true_type {};
+
+// Whether a chain ends in collect().
+template<typename... ProcessingStages>
+struct collects : std::false_type {};
+
+template<typename F, typename... ProcessingStages>
+struct collects<F, ProcessingStages...> : is_collector<std::decay_t<typename std::tuple_element<sizeof...(ProcessingStages), std::tuple<F, ProcessingStages...>>::type>> {};
+
+template<typename>
+using unused_t = ROOT::unused;
+
+/**
+ * The terminal stage added by saveSelection(): collects the entries passing
+ * the filters in front of it.  It does not look at the event itself; the
+ * processor records each passing entry with file_runs() and the runs are
+ * written to `path` once processing is done.
+ */
+template<typename... InputArgs>
+class TTreeProcessorSelectionRecorder final : public TTreeProcessorMapper<std::tuple<>, InputArgs...>, public TTreeProcessorThreadLocal, public TTreeProcessorTerminalBase {
+  public:
+    typedef TEntrySelection result_type;
+
+    TTreeProcessorSelectionRecorder(const std::string &path) : m_path(path) {}
+    TTreeProcessorSelectionRecorder(TTreeProcessorSelectionRecorder &&) = default;
+    // Per-thread clones start with an empty selection.
+    TTreeProcessorSelectionRecorder(const TTreeProcessorSelectionRecorder &rhs) : m_path(rhs.m_path) {}
+
+    std::tuple<> map(unused_t<InputArgs>...) const noexcept {return std::tuple<>();}
+
+    TEntrySelection::runs_type &file_runs(const std::string &file) {return m_selection.file_runs(file);}
+
+    void merge(const TTreeProcessorSelectionRecorder &clone) {m_selection.merge(clone.m_selection);}
+
+    bool finalize() {
+      m_selection.normalize();
+      if (!m_selection.save(m_path)) {
+        std::cerr << "Failed to write the selection to " << m_path << ".\n";
+        return false;
+      }
+      return true;
+    }
+
+    // Returns the selection of the last process call and starts over.
+    result_type result() {
+      TEntrySelection selection = m_selection;
+      m_selection.clear();
+      return selection;
+    }
+
+  private:
+    std::string m_path;
+    TEntrySelection m_selection{true};
+};
+
+template<typename InputTuple>
+struct selection_recorder_type;
+
+template<typename... InputArgs>
+struct selection_recorder_type<std::tuple<InputArgs...>> {
+  typedef TTreeProcessorSelectionRecorder<InputArgs...> type;
+};
+
+template<typename T>
+struct is_selection_recorder : std::false_type {};
+
+template<typename... InputArgs>
+struct is_selection_recorder<TTreeProcessorSelectionRecorder<InputArgs...>> : std::true_type {};
+
+// Whether a chain ends in saveSelection().
+template<typename... ProcessingStages>
+struct records_selection : std::false_type {};
+
+template<typename F, typename... ProcessingStages>
+struct records_selection<F, ProcessingStages...> : is_selection_recorder<std::decay_t<typename std::tuple_element<sizeof...(ProcessingStages), std::tuple<F, ProcessingStages...>>::type>> {};
+
 }  // internal
 
 }  // ROOT
@@ -0,0 +1,55 @@
+#ifndef __BENCH_HELPERS_H_
+#define __BENCH_HELPERS_H_
+
+#include <chrono>
+#include <initializer_list>
+#include <iostream>
+
+#include "TFile.h"
+#include "TTree.h"
+
+/**
+ * Timing and input handling shared by the benchmark programs.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static inline double
+sec_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static inline double
+usec_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/**
+ * Print one usage line per form of the arguments; returns the exit code
+ * for a bad command line.
+ */
+static inline int
+bench_usage(const char *program, std::initializer_list<const char*> forms) {
+  const char *prefix = "Usage: ";
+  for (const char *args : forms) {
+    std::cerr << prefix << program << " " << args << "\n";
+    prefix = "       ";
+  }
+  return 1;
+}
+
+/**
+ * Open fname and return its tree T, or nullptr (with a message) if it has
+ * none; file is set to the opened file.
+ */
+static inline TTree *
+open_bench_tree(const char *fname, TFile *&file) {
+  file = TFile::Open(fname);
+  TTree *tree = static_cast<TTree*>(file->GetObjectChecked("T", "TTree"));
+  if (!tree) {
+    std::cerr << "No tree named T in " << fname << "\n";
+  }
+  return tree;
+}
+
+#endif  // __BENCH_HELPERS_H_
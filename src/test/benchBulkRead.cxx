@@ -0,0 +1,66 @@
+
+#include <iostream>
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+#include "BenchHelpers.h"
+
+/**
+ * Throughput of the vectorized read paths: per-event TTreeReader reads
+ * packed into Vc vectors versus bulk basket decoding.
+ *
+ * Use `benchReaderSetup write fname entries cluster_size` to generate input.
+ */
+
+typedef std::tuple<float, int, double> BranchTypes;
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {return bench_usage(argv[0], {"fname"});}
+
+  TFile *tf = nullptr;
+  TTree *tree = open_bench_tree(argv[1], tf);
+  if (!tree) {return 1;}
+  Long64_t entries = tree->GetEntries();
+  ROOT::internal::convert_to_strings<BranchTypes>::type branches("a", "b", "c");
+
+  // Current path: TTreeReader::Next() per event, then load into vectors.
+  ROOT::floatv reader_sum = 0;
+  auto start = Clock::now();
+  {
+    TTreeReader myReader("T", tf);
+    auto readerValues = ROOT::internal::make_reader_tuple<BranchTypes>(myReader, branches);
+    while (myReader.Next()) {
+      auto data = ROOT::internal::read_event_data<1, BranchTypes, TTreeReader, decltype(readerValues)>()(myReader, readerValues);
+      reader_sum(std::get<0>(data)) += std::get<1>(data);
+    }
+  }
+  double reader_time = sec_since(start);
+
+  // Bulk path: decode whole baskets into aligned buffers.
+  ROOT::floatv bulk_sum = 0;
+  start = Clock::now();
+  {
+    ROOT::internal::TBulkReader<BranchTypes> bulk(tree, branches);
+    if (!bulk.valid()) {
+      std::cerr << "Branches a, b, c are not bulk-readable.\n";
+      return 1;
+    }
+    for (Long64_t chunkStart = 0; chunkStart < entries; chunkStart += bulk.chunk_size) {
+      bulk.fill(chunkStart, std::min(chunkStart + bulk.chunk_size, entries));
+      for (Long64_t offset = 0; offset < bulk.size(); offset += ROOT::vector_count) {
+        auto data = bulk.get(offset);
+        bulk_sum(std::get<0>(data)) += std::get<1>(data);
+      }
+    }
+  }
+  double bulk_time = sec_since(start);
+
+  std::cout << "Entries: " << entries << " (checksums " << reader_sum.sum() << ", " << bulk_sum.sum() << ")\n";
+  std::cout << "TTreeReader path: " << entries / reader_time / 1e6 << " Mevents/s\n";
+  std::cout << "Bulk path:        " << entries / bulk_time / 1e6 << " Mevents/s\n";
+
+  return 0;
+}
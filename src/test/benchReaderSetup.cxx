@@ -0,0 +1,100 @@
+
+#include <cstring>
+#include <iostream>
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+#include "BenchHelpers.h"
+
+/**
+ * Measure the per-cluster cost of setting up the TTreeReader.
+ *
+ * Compares building a fresh TTreeReader and set of TTreeReaderValues for every
+ * cluster (the old processParallel behavior) against re-targeting a cached
+ * reader from a TTreeReaderPool.
+ */
+
+typedef std::tuple<float, int, double> BranchTypes;
+
+static int
+write_file(const char *fname, Long64_t entries, Long64_t clusterSize) {
+  TFile *hfile = new TFile(fname, "RECREATE", "Reader setup benchmark file");
+  hfile->SetCompressionLevel(1);
+  TTree *tree = new TTree("T", "Many small clusters.");
+  float a; int b; double c;
+  tree->Branch("a", &a, "a/F");
+  tree->Branch("b", &b, "b/I");
+  tree->Branch("c", &c, "c/D");
+  tree->SetAutoFlush(clusterSize);
+  for (Long64_t ev = 0; ev < entries; ev++) {
+    a = ev % 10; b = ev; c = 0.5*ev;
+    tree->Fill();
+  }
+  hfile->Write();
+  hfile->Close();
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc == 5 && !strcmp(argv[1], "write")) {
+    return write_file(argv[2], std::stoll(argv[3]), std::stoll(argv[4]));
+  }
+  if (argc != 2) {return bench_usage(argv[0], {"fname", "write fname entries cluster_size"});}
+
+  TFile *tf = nullptr;
+  TTree *tree = open_bench_tree(argv[1], tf);
+  if (!tree) {return 1;}
+  std::vector<std::pair<Long64_t, Long64_t>> clusters;
+  TTree::TClusterIterator clusterIter = tree->GetClusterIterator(0);
+  Long64_t clusterStart;
+  while ( (clusterStart = clusterIter()) < tree->GetEntries() ) {
+    clusters.emplace_back(clusterStart, clusterIter.GetNextEntry());
+  }
+
+  ROOT::internal::convert_to_strings<BranchTypes>::type branches("a", "b", "c");
+  double sum = 0;
+
+  // Before: a fresh reader per cluster.
+  double rebuild_setup = 0;
+  auto start = Clock::now();
+  for (const auto &cluster : clusters) {
+    auto setup_start = Clock::now();
+    TTreeReader myReader("T", tf);
+    auto readerValues = ROOT::internal::make_reader_tuple<BranchTypes>(myReader, branches);
+    myReader.SetEntriesRange(cluster.first, cluster.second);
+    rebuild_setup += usec_since(setup_start);
+    while (myReader.Next()) {sum += **std::get<0>(readerValues);}
+  }
+  double rebuild_total = usec_since(start);
+
+  // After: one pooled reader, re-targeted per cluster.
+  double pooled_setup = 0;
+  ROOT::internal::TTreeReaderPool<BranchTypes> pool(tf->GetEndpointUrl()->GetUrl(), "T", branches);
+  start = Clock::now();
+  for (const auto &cluster : clusters) {
+    auto setup_start = Clock::now();
+    auto entry = pool.get();
+    entry->setRange(cluster.first, cluster.second);
+    pooled_setup += usec_since(setup_start);
+    while (entry->reader().Next()) {sum += **std::get<0>(entry->values());}
+  }
+  double pooled_total = usec_since(start);
+
+  std::cout << "Clusters: " << clusters.size() << " (checksum " << sum << ")\n";
+  std::cout << "Rebuild per cluster: " << rebuild_setup / clusters.size() << " us setup/cluster, " << rebuild_total / 1e3 << " ms total\n";
+  std::cout << "Pooled reader:       " << pooled_setup / clusters.size() << " us setup/cluster, " << pooled_total / 1e3 << " ms total\n";
+
+  ROOT::TTreeProcessor<BranchTypes> processor({"a", "b", "c"});
+  start = Clock::now();
+  processor
+    .filter([](float x, int, double) {return x <= 5;})
+    .map([](float x, int, double) -> std::tuple<float> {return std::make_tuple(x);})
+    .count()
+    .processParallel("T", {tf});
+  std::cout << "processParallel: " << usec_since(start) / 1e3 << " ms\n";
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include <cmath>
+#include <iostream>
+
+#include "tbb/task_arena.h"
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+#include "BenchHelpers.h"
+
+/**
+ * Strong scaling of processParallel: the same chain over the same file with
+ * 1..N worker threads.
+ *
+ * Use `benchReaderSetup write fname entries cluster_size` to generate input;
+ * a file with few, large clusters shows the benefit of splitting clusters.
+ */
+
+typedef std::tuple<float, int, double> BranchTypes;
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {return bench_usage(argv[0], {"fname [max_threads]"});}
+  int max_threads = (argc == 3) ? std::stoi(argv[2]) : tbb::this_task_arena::max_concurrency();
+
+  TFile *tf = nullptr;
+  TTree *tree = open_bench_tree(argv[1], tf);
+  if (!tree) {return 1;}
+  Long64_t entries = tree->GetEntries();
+
+  auto processor = ROOT::TTreeProcessor<BranchTypes>({"a", "b", "c"})
+    .filter([](float x, int, double) {return x <= 5;})
+    .map([](float x, int y, double z) -> std::tuple<double> {
+        double value = z;
+        for (int idx=0; idx<16; idx++) {value = std::sqrt(value + x*y);}
+        return std::make_tuple(value);
+      })
+    .reduce(0.0, [](double sum, double value) {return sum + value;});
+
+  double single_time = 0;
+  std::cout << "threads  seconds  Mevents/s  speedup  efficiency\n";
+  for (int threads = 1; threads <= max_threads; threads++) {
+    tbb::task_arena arena(threads);
+    double checksum = 0;
+    auto start = Clock::now();
+    arena.execute([&]() {checksum = processor.processParallel("T", {tf});});
+    double elapsed = sec_since(start);
+    if (threads == 1) {single_time = elapsed;}
+    std::cout << threads << "  " << elapsed << "  " << entries / elapsed / 1e6 << "  "
+              << single_time / elapsed << "  " << single_time / elapsed / threads
+              << "  (checksum " << checksum << ")\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <iostream>
+
+#include "TTree.h"
+
+#include "Event.h"
+#include "TTreeProcessor.h"
+
+#include "BenchHelpers.h"
+
+/**
+ * Split object members: sum a few basic-type members of the `event` branch
+ * of Event.root, once by reading whole Event objects through the
+ * TTreeReader and once by naming the members ("event.fNtrack", ...) so
+ * that only their baskets are read and decoded, without ever constructing
+ * an Event.
+ *
+ * Use `testEvent nevents 1 1 1` to write a split Event.root.
+ */
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {return bench_usage(argv[0], {"Event.root"});}
+
+  TFile *tf = nullptr;
+  TTree *tree = open_bench_tree(argv[1], tf);
+  if (!tree) {return 1;}
+  Long64_t entries = tree->GetEntries();
+
+  Long64_t bytes = TFile::GetFileBytesRead();
+  auto start = Clock::now();
+  TTreeReader reader(tree);
+  TTreeReaderValue<Event> event(reader, "event");
+  long object_sum = 0;
+  while (reader.Next()) {
+    object_sum += event->GetNtrack() + event->GetNseg() + (event->GetFlag() & 0xff);
+  }
+  double object_time = sec_since(start);
+  Long64_t object_bytes = TFile::GetFileBytesRead() - bytes;
+
+  bytes = TFile::GetFileBytesRead();
+  start = Clock::now();
+  ROOT::TTreeProcessor<std::tuple<int, int, unsigned>> scalar(std::make_tuple("event.fNtrack", "event.fNseg", "event.fFlag"));
+  long scalar_sum = scalar
+    .map([](int ntrack, int nseg, unsigned flag) -> std::tuple<long> {return ntrack + nseg + (flag & 0xff);})
+    .reduce(0l, [](long sum, long x) {return sum + x;})
+    .process("T", {tf});
+  double scalar_time = sec_since(start);
+  Long64_t scalar_bytes = TFile::GetFileBytesRead() - bytes;
+
+  bytes = TFile::GetFileBytesRead();
+  start = Clock::now();
+  ROOT::TTreeProcessor<std::tuple<int, int, unsigned>> vectorized(std::make_tuple("event.fNtrack", "event.fNseg", "event.fFlag"));
+  long vectorized_sum = vectorized
+    .filter([](ROOT::maskv, ROOT::intv ntrack, ROOT::intv, ROOT::uintv) {return ntrack >= 0;})
+    .map([](int ntrack, int nseg, unsigned flag) -> std::tuple<long> {return ntrack + nseg + (flag & 0xff);})
+    .reduce(0l, [](long sum, long x) {return sum + x;})
+    .process("T", {tf});
+  double vectorized_time = sec_since(start);
+  Long64_t vectorized_bytes = TFile::GetFileBytesRead() - bytes;
+
+  std::cout << "Summed " << entries << " events (checksums " << object_sum << ", " << scalar_sum << ", " << vectorized_sum << ")\n";
+  std::cout << "  Whole Event:         " << entries / object_time / 1e6 << " Mevents/s, " << object_bytes << " bytes read\n";
+  std::cout << "  Members, scalar:     " << entries / scalar_time / 1e6 << " Mevents/s, " << scalar_bytes << " bytes read\n";
+  std::cout << "  Members, vectorized: " << entries / vectorized_time / 1e6 << " Mevents/s, " << vectorized_bytes << " bytes read\n";
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+
+#include <fstream>
+#include <iostream>
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+// Only the filtered branch is read ahead of a range filter.
+typedef ROOT::internal::range_filter_type<1, std::tuple<float, int, double>>::type RangeFilterB;
+static_assert(ROOT::internal::late_materialization<std::tuple<float, int, double>, RangeFilterB>::deferred, "Range filters should allow late materialization.");
+
+/**
+ * Build a cluster index for the run-ordered branch `b`, then check that
+ * filterRange skips the clusters it rules out without changing the result.
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr <<"Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+  TTree *tree = static_cast<TTree*>(tf->GetObjectChecked("T", "TTree"));
+  if (!tree) {
+    std::cerr << "No tree named T in " << argv[1] << "\n";
+    return 1;
+  }
+
+  ROOT::TClusterIndex index = ROOT::TClusterIndex::build(tree, {"a", "b"});
+  if (!index.save(ROOT::TClusterIndex::sidecar(tf->GetName(), "T"))) {
+    std::cerr << "Failed to write the cluster index.\n";
+    return 1;
+  }
+  ROOT::TClusterIndex loaded = ROOT::TClusterIndex::load(ROOT::TClusterIndex::sidecar(tf->GetName(), "T"));
+  if (!loaded.matches(tree)) {
+    std::cerr << "The saved cluster index does not match the tree.\n";
+    return 1;
+  }
+
+  // An index of another file with the same layout must not be used.
+  {
+    std::ifstream in(ROOT::TClusterIndex::sidecar(tf->GetName(), "T"));
+    std::string magic, uuid, rest;
+    std::getline(in, magic);
+    std::getline(in, uuid);
+    std::getline(in, rest, '\0');
+    std::ofstream out("testClusterIndex.stale.zonemap");
+    out << magic << "\n" << "00000000-0000-0000-0000-000000000001" << "\n" << rest;
+  }
+  if (ROOT::TClusterIndex::load("testClusterIndex.stale.zonemap").matches(tree)) {
+    std::cerr << "A cluster index of another file matches the tree.\n";
+    return 1;
+  }
+
+  double lo = tree->GetEntries() / 4, hi = tree->GetEntries() / 2;
+  Long64_t kept = 0;
+  for (const auto &range : loaded.select({{"b", lo, hi}})) {kept += range.second - range.first;}
+  std::cout << "Clusters: " << loaded.clusters() << "; entries left to read for " << lo << " <= b <= " << hi << ": " << kept << " of " << tree->GetEntries() << "\n";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor({"a", "b", "c"});
+  long count = processor
+    .filterRange<1>(lo, hi)
+    .map([](float, int, double) -> std::tuple<long> {return 1;})
+    .reduce(0l, [](long count, long one) {return count + one;})
+    .process("T", {tf});
+  std::cout << "Events with " << lo << " <= b <= " << hi << ": " << count << "\n";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_parallel({"a", "b", "c"});
+  count = processor_parallel
+    .filterRange<1>(lo, hi)
+    .filterRange<0>(2, 3)
+    .map([](float, int, double) -> std::tuple<long> {return 1;})
+    .reduce(0l, [](long count, long one) {return count + one;})
+    .processParallel("T", {tf});
+  std::cout << "Events with " << lo << " <= b <= " << hi << " and 2 <= a <= 3: " << count << "\n";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_pipelined({"a", "b", "c"});
+  count = processor_pipelined
+    .filterRange<1>(lo, hi)
+    .map([](float, int, double) -> std::tuple<long> {return 1;})
+    .reduce(0l, [](long count, long one) {return count + one;})
+    .processPipelined("T", {tf});
+  std::cout << "Pipelined events with " << lo << " <= b <= " << hi << ": " << count << "\n";
+
+  return 0;
+}
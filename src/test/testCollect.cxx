@@ -0,0 +1,54 @@
+
+#include <iostream>
+
+#include "TTreeProcessor.h"
+
+/**
+ * Collect a filtered, mapped column with processParallel and check that the
+ * rows come back in entry order, whichever thread processed each cluster.
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+  if (!tf->GetObjectChecked("T", "TTree")) {
+    std::cerr << "No tree named T in " << argv[1] << "\n";
+    return 1;
+  }
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> count_processor({"a", "b", "c"});
+  int expected = count_processor
+    .filter([](float a, int, double) {return a < 5;})
+    .map([](float, int, double) -> std::tuple<int> {return 1;})
+    .reduce(0, [](int sum, int x) {return sum + x;})
+    .process("T", {tf});
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor({"a", "b", "c"});
+  auto columns = processor
+    .filter([](float a, int, double) {return a < 5;})
+    .map([](float a, int b, double c) -> std::tuple<int, double> {return std::make_tuple(b, a*c);})
+    .collect()
+    .processParallel("T", {tf});
+  const std::vector<int> &entries = std::get<0>(columns);
+  bool ordered = std::is_sorted(entries.begin(), entries.end()) &&
+                 std::adjacent_find(entries.begin(), entries.end()) == entries.end();
+  std::cout << "Collected " << entries.size() << " rows (expected " << expected << "), "
+            << (ordered ? "in entry order" : "OUT OF ORDER") << "\n";
+
+  // A vectorized chain is unpacked in front of the collector.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> vectorized({"a", "b", "c"});
+  auto vectorized_columns = vectorized
+    .filter([](ROOT::maskv, ROOT::floatv a, ROOT::intv, ROOT::doublev) {return a < 5;})
+    .collect()
+    .processParallel("T", {tf});
+  bool matches = std::get<1>(vectorized_columns) == entries;
+  std::cout << "Vectorized collect: " << std::get<1>(vectorized_columns).size() << " rows, "
+            << (matches ? "matching" : "NOT matching") << "\n";
+
+  return (ordered && matches && static_cast<int>(entries.size()) == expected) ? 0 : 1;
+}
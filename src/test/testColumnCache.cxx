@@ -0,0 +1,111 @@
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+/**
+ * Run the same chains without a cache (an empty cache() directory), then
+ * twice with one: the first pass decodes the baskets and fills the cache,
+ * the second is served from the memory-mapped cache files.  Then again
+ * with a bulk read failing halfway through the tree (the test is built
+ * with -DTTREEPROCESSOR_TEST_HOOKS).  All passes must agree.
+ */
+
+typedef std::tuple<float, int, double> BranchTypes;
+
+static const char *cache_dir = "testColumnCache.d";
+
+struct Sums {
+  double scalar;
+  double vectorized;
+  double blocks;
+};
+
+static Sums
+run(TFile *tf, const std::string &directory) {
+  Sums sums;
+  ROOT::TTreeProcessor<BranchTypes> scalar({"a", "b", "c"});
+  sums.scalar = scalar
+    .cache(directory)
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .process("T", {tf});
+
+  ROOT::TTreeProcessor<BranchTypes> vectorized({"a", "b", "c"});
+  sums.vectorized = vectorized
+    .cache(directory)
+    .filter([](ROOT::maskv, ROOT::floatv a, ROOT::intv, ROOT::doublev) {return a < 5;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .processParallel("T", {tf});
+
+  ROOT::TTreeProcessor<BranchTypes> blocks({"a", "b", "c"});
+  sums.blocks = blocks
+    .cache(directory)
+    .filter([](float a, int, double) {return a >= 5;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .blocks(100)
+    .processParallel("T", {tf});
+  return sums;
+}
+
+static bool
+same(double value, double expected) {
+  return std::abs(value - expected) <= 1e-9 * std::abs(expected);
+}
+
+static bool
+check(const char *label, const Sums &sums, const Sums &expected) {
+  bool ok = same(sums.scalar, expected.scalar) && same(sums.vectorized, expected.vectorized) && same(sums.blocks, expected.blocks);
+  std::cout << label << ": " << sums.scalar << " " << sums.vectorized << " " << sums.blocks << (ok ? "" : " MISMATCH") << "\n";
+  return ok;
+}
+
+// Remove the cache files of tree T, so that the next cached pass is cold.
+static void
+clear_cache(TFile *tf) {
+  for (const char *branch : {"a", "b", "c"}) {
+    std::remove(ROOT::internal::TColumnCache<BranchTypes>::path(cache_dir, tf, "T", branch).c_str());
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+  TTree *tree = static_cast<TTree*>(tf->GetObjectChecked("T", "TTree"));
+  if (!tree) {
+    std::cerr << "No tree named T in " << argv[1] << "\n";
+    return 1;
+  }
+
+  mkdir(cache_dir, 0755);
+  clear_cache(tf);
+
+  Sums expected = run(tf, "");
+  bool ok = check("Uncached", expected, expected);
+  ok = check("Cold cache", run(tf, cache_dir), expected) && ok;
+  ok = check("Warm cache", run(tf, cache_dir), expected) && ok;
+
+  // A range the bulk reader fails to decode is never cached; the rest of
+  // it is read with the TTreeReader instead, on every pass.
+  clear_cache(tf);
+  ROOT::internal::bulk_read_fault_entry() = tree->GetEntries() / 2;
+  ok = check("Cold cache, failed read", run(tf, cache_dir), expected) && ok;
+  ok = check("Warm cache, failed read", run(tf, cache_dir), expected) && ok;
+
+  return ok ? 0 : 1;
+}
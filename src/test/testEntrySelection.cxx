@@ -0,0 +1,138 @@
+
+#include <cmath>
+#include <iostream>
+
+#include "TTreeProcessor.h"
+
+/**
+ * Record the entries passing a preselection once, then replay it for
+ * another chain without evaluating the filters again.
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr <<"Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+  std::string path = std::string(tf->GetName()) + ".selection";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> preselection({"a", "b", "c"});
+  ROOT::TEntrySelection selection = preselection
+    .filter([](float a, ROOT::unused, ROOT::unused) {return a >= 3 && a < 6;})
+    .filter([](ROOT::unused, int b, ROOT::unused) {return b % 2 == 0;})
+    .saveSelection(path)
+    .processParallel("T", {tf});
+  std::cout << "Selected " << selection.count() << " entries in " << selection.runs(tf->GetEndpointUrl()->GetUrl()).size() << " runs.\n";
+
+  ROOT::TEntrySelection loaded = ROOT::TEntrySelection::load(path);
+  if (!selection.valid() || !loaded.valid() || loaded.count() != selection.count()) {
+    std::cerr << "Failed to read back the selection from " << path << ".\n";
+    return 1;
+  }
+  if (ROOT::TEntrySelection::load(path + ".missing").valid()) {
+    std::cerr << "A missing selection file should not load as valid.\n";
+    return 1;
+  }
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> replay({"a", "b", "c"});
+  double sum = replay
+    .map([](float a, int b, double c) -> std::tuple<double> {return c;})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .processParallel("T", {tf}, loaded);
+  std::cout << "Sum of c over the selection: " << sum << "\n";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> direct({"a", "b", "c"});
+  double expected = direct
+    .filter([](float a, int b, double) {return a >= 3 && a < 6 && b % 2 == 0;})
+    .map([](float, int, double c) -> std::tuple<double> {return c;})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .process("T", {tf});
+
+  // Vectorized and block-at-a-time replays skip the unselected entries of
+  // each cluster.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> replay_vectorized({"a", "b", "c"});
+  double vectorized_sum = replay_vectorized
+    .map([](ROOT::maskv, ROOT::floatv, ROOT::intv, ROOT::doublev c) -> std::tuple<ROOT::doublev> {return {c};})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .processParallel("T", {tf}, loaded);
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> replay_blocks({"a", "b", "c"});
+  double blocks_sum = replay_blocks
+    .map([](float, int, double c) -> std::tuple<double> {return c;})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .blocks(3)
+    .processParallel("T", {tf}, loaded);
+
+  bool ok = true;
+  for (double replayed : {sum, vectorized_sum, blocks_sum}) {
+    ok = ok && std::abs(replayed - expected) <= 1e-9 * std::abs(expected);
+  }
+  if (!ok) {
+    std::cerr << "Replayed sums " << sum << " " << vectorized_sum << " " << blocks_sum << " differ from " << expected << ".\n";
+    return 1;
+  }
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> replay_serial({"a", "b", "c"});
+  replay_serial
+    .filter([](float a, int b, double c) {return a <= 4;})
+    .count()
+    .process("T", {tf}, loaded);
+
+  // A sparse selection in one large cluster: the bulk reader only decodes
+  // the stretches holding selected entries (the test is built with
+  // -DTTREEPROCESSOR_TEST_HOOKS to count them).
+  TFile *sparse_out = TFile::Open("selection_sparse.root", "RECREATE");
+  TTree *sparse_tree = new TTree("T", "One cluster");
+  float a; int b; double c;
+  sparse_tree->Branch("a", &a);
+  sparse_tree->Branch("b", &b);
+  sparse_tree->Branch("c", &c);
+  const Long64_t sparse_entries = 20000;
+  sparse_tree->SetAutoFlush(sparse_entries);
+  for (Long64_t ev = 0; ev < sparse_entries; ev++) {
+    a = ev % 10; b = ev; c = 0.5*ev;
+    sparse_tree->Fill();
+  }
+  sparse_tree->Write();
+  sparse_out->Close();
+  TFile *sparse_file = TFile::Open("selection_sparse.root");
+
+  ROOT::TEntrySelection sparse(true);
+  auto &runs = sparse.file_runs(sparse_file->GetEndpointUrl()->GetUrl());
+  runs = {{0, 10}, {10000, 10010}, {19990, 20000}};
+  double sparse_expected = 0;
+  for (const auto &run : runs) {
+    for (Long64_t ev = run.first; ev < run.second; ev++) {sparse_expected += 0.5*ev;}
+  }
+
+  ROOT::internal::bulk_read_entry_count() = 0;
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> sparse_vectorized({"a", "b", "c"});
+  double sparse_vectorized_sum = sparse_vectorized
+    .map([](ROOT::maskv, ROOT::floatv, ROOT::intv, ROOT::doublev c) -> std::tuple<ROOT::doublev> {return {c};})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .processParallel("T", {sparse_file}, sparse);
+  Long64_t vectorized_decoded = ROOT::internal::bulk_read_entry_count();
+
+  ROOT::internal::bulk_read_entry_count() = 0;
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> sparse_blocks({"a", "b", "c"});
+  double sparse_blocks_sum = sparse_blocks
+    .map([](float, int, double c) -> std::tuple<double> {return c;})
+    .reduce(0., [](double sum, double c) {return sum + c;})
+    .blocks(16)
+    .processParallel("T", {sparse_file}, sparse);
+  Long64_t blocks_decoded = ROOT::internal::bulk_read_entry_count();
+
+  // One decoded entry per branch and selected entry.
+  Long64_t decoded_expected = 3 * sparse.count();
+  if (sparse_vectorized_sum != sparse_expected || sparse_blocks_sum != sparse_expected ||
+      vectorized_decoded != decoded_expected || blocks_decoded != decoded_expected) {
+    std::cerr << "Sparse replays summed " << sparse_vectorized_sum << " " << sparse_blocks_sum << " (expected " << sparse_expected
+              << ") and decoded " << vectorized_decoded << " " << blocks_decoded << " entries (expected " << decoded_expected << ").\n";
+    return 1;
+  }
+
+  return 0;
+}
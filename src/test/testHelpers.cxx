@@ -32,6 +32,11 @@ class MapFive : ROOT::TTreeProcessorMapper<std::tuple<int>, int> {
 class FilterOne : ROOT::TTreeProcessorFilter<float> {
 };
 
+class EmitOne : ROOT::internal::TTreeProcessorEmitterBase {
+  public:
+    typedef std::tuple<int> output_type;
+};
+
 static_assert(std::is_same<std::result_of<decltype(&MapOne::map)(MapOne, float, float)>::type, std::tuple<int, int>>::value, "");
 
 
@@ -70,6 +75,54 @@ static_assert(GetStageType<1, MapOne, MapTwo>::value == 1, "");
 static_assert(GetStageType<1, MapOne, FilterOne>::value == 0, "");
 static_assert(GetStageType<2, MapOne, MapTwo, FilterOne>::value == 0, "");
 static_assert(GetStageType<2, MapOne, MapTwo, MapThree>::value == 1, "");
+static_assert(GetStageType<1, FilterOne, EmitOne, MapTwo>::value == 2, "");
+static_assert(std::is_same<ProcessorArgHelper<0, 1, std::tuple<float, float>, FilterOne, EmitOne, MapFive>::output_type, std::tuple<int>>::value, "");
+
+class CloneOne : ROOT::TTreeProcessorMapper<std::tuple<int>, int>, public ROOT::TTreeProcessorThreadLocal {
+  public:
+    std::tuple<int> map(int);
+};
+
+// Only stages deriving from TTreeProcessorThreadLocal are cloned per thread.
+static_assert(ROOT::is_thread_local_stage<CloneOne>::value, "");
+static_assert(!ROOT::is_thread_local_stage<MapOne>::value, "");
+static_assert(GetStageType<0, CloneOne>::value == 1, "");
+
+class ReduceOne : ROOT::TTreeProcessorMapper<std::tuple<>, int>, public ROOT::internal::TTreeProcessorTerminalBase {
+  public:
+    typedef double result_type;
+};
+
+// Processing returns the result of a terminal last stage, void otherwise.
+static_assert(std::is_same<chain_result<MapFive, ReduceOne>::type, double>::value, "");
+static_assert(chain_result<MapFive, ReduceOne>::is_terminated, "");
+static_assert(std::is_same<chain_result<MapFive>::type, void>::value, "");
+static_assert(!chain_result<>::is_terminated, "");
+
+class LateFilter : public ROOT::TTreeProcessorFilter<float, float> {
+  public:
+    bool filter(float, ROOT::unused) const noexcept;
+};
+
+// Branches not looked at by the leading filters are read after them.
+static_assert(std::is_same<late_materialization<std::tuple<float, float>, LateFilter, MapOne>::early, std::integer_sequence<bool, true, false>>::value, "");
+static_assert(std::is_same<late_materialization<std::tuple<float, float>, LateFilter, MapOne>::late, std::integer_sequence<bool, false, true>>::value, "");
+static_assert(late_materialization<std::tuple<float, float>, LateFilter, MapOne>::deferred, "");
+static_assert(late_materialization<std::tuple<float, float>, LateFilter, FilterOne, MapOne>::filter_count == 2, "");
+static_assert(!late_materialization<std::tuple<float, float>, LateFilter, FilterOne, MapOne>::deferred, "");
+static_assert(!late_materialization<std::tuple<float, float>, MapOne, LateFilter>::deferred, "");
+
+class MapUnused : public ROOT::TTreeProcessorMapper<std::tuple<int>, float, float> {
+  public:
+    std::tuple<int> map(ROOT::unused, float) const noexcept;
+};
+
+// A branch is pruned unless some stage looks at it.
+static_assert(std::is_same<used_branches<std::tuple<float, float>, MapUnused>::type, std::integer_sequence<bool, false, true>>::value, "");
+static_assert(std::is_same<used_branches<std::tuple<float, float>, LateFilter, MapUnused>::type, std::integer_sequence<bool, true, true>>::value, "");
+static_assert(std::is_same<used_branches<std::tuple<float, float>, LateFilter>::type, std::integer_sequence<bool, true, false>>::value, "");
+static_assert(std::is_same<used_branches<std::tuple<float, float>, MapOne, MapUnused>::type, std::integer_sequence<bool, true, true>>::value, "");
+static_assert(std::is_same<all_branches_t<std::tuple<float, float>>, std::integer_sequence<bool, true, true>>::value, "");
 
 //static_assert(std::is_same<ProcessorResult<std::tuple<float, float>, MapOne, FilterOne, MapTwo>::output_type, std::tuple<double, double>>::value, "");
 static_assert(std::is_same<ProcessorResult<std::tuple<float, float>, MapOne, MapTwo, MapThree, MapFive>::output_type, std::tuple<int>>::value, "");
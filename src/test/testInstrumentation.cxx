@@ -0,0 +1,83 @@
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "TTreeProcessor.h"
+
+/**
+ * Run instrumented chains (built with -DTTREEPROCESSOR_INSTRUMENT) over
+ * events held in memory and check the event counts in the reports.
+ */
+
+typedef std::tuple<float, int> Event;
+
+static bool
+check_report(const std::string &fileName, const std::vector<std::string> &expected) {
+  std::ifstream in(fileName);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::string report = ss.str();
+  bool ok = true;
+  for (const auto &counts : expected) {
+    if (report.find(counts) == std::string::npos) {
+      std::cout << "Missing from " << fileName << ": " << counts << "\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main()
+{
+  const Long64_t entries = 10003;
+  std::vector<float> a(entries);
+  std::vector<int> b(entries);
+  for (Long64_t idx = 0; idx < entries; idx++) {
+    a[idx] = idx % 10;
+    b[idx] = idx % 3;
+  }
+  ROOT::TMemorySource<Event> source(a, b);
+
+  // 5003 events have a < 5; each emits b tuples, 5002 in total.
+  ROOT::TTreeProcessor<Event> scalar({"a", "b"});
+  scalar
+    .filter([](float a, int) {return a < 5;})
+    .flatMap<std::tuple<float>>([](float a, int b, auto &emit) {for (int idx = 0; idx < b; idx++) {emit(a);}})
+    .map([](float a) -> std::tuple<double> {return a * 2;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .report("instrumentation_scalar.json")
+    .processParallel(source);
+  bool ok = check_report("instrumentation_scalar.json", {
+    "\"index\": 0, \"kind\": \"filter\", \"vectorized\": false, \"calls\": 10003, \"events_in\": 10003, \"events_out\": 5003",
+    "\"index\": 1, \"kind\": \"emit\", \"vectorized\": false, \"calls\": 5003, \"events_in\": 5003, \"events_out\": 5002",
+    "\"index\": 2, \"kind\": \"map\", \"vectorized\": false, \"calls\": 5002, \"events_in\": 5002, \"events_out\": 5002"});
+
+  // Vectorized stages count the active lanes.
+  ROOT::TTreeProcessor<Event> vectorized({"a", "b"});
+  vectorized
+    .filter([](ROOT::maskv, ROOT::floatv a, ROOT::intv) {return a < 5;})
+    .filter([](ROOT::maskv, ROOT::floatv, ROOT::intv b) {return b == 0;})
+    .map([](float a, int) -> std::tuple<double> {return a;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .report("instrumentation_vectorized.json")
+    .processParallel(source);
+  ok = check_report("instrumentation_vectorized.json", {
+    "\"index\": 0, \"kind\": \"filter\", \"vectorized\": true, \"calls\": " + std::to_string((entries + ROOT::vector_count - 1) / ROOT::vector_count) + ", \"events_in\": 10003, \"events_out\": 5003",
+    "\"events_in\": 5003, \"events_out\": 1668"}) && ok;
+
+  // Block stages are probed once per block.
+  ROOT::TTreeProcessor<Event> blocks({"a", "b"});
+  blocks
+    .filter([](float a, int) {return a < 5;})
+    .map([](float a, int b) -> std::tuple<double> {return a * b;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .blocks(1000)
+    .report("instrumentation_blocks.json")
+    .process(source);
+  ok = check_report("instrumentation_blocks.json", {
+    "\"index\": 0, \"kind\": \"filter\", \"vectorized\": false, \"calls\": 12, \"events_in\": 10003, \"events_out\": 5003",
+    "\"index\": 1, \"kind\": \"map\", \"vectorized\": false, \"calls\": 12, \"events_in\": 5003, \"events_out\": 5003"}) && ok;
+
+  return ok ? 0 : 1;
+}
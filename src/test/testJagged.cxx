@@ -0,0 +1,97 @@
+
+#include <iostream>
+
+#include "TTree.h"
+
+#include "TTreeProcessor.h"
+
+/**
+ * Variable-length branches: the per-event tracks of branch `px` arrive as
+ * spans, event-at-a-time and flattened into blocks.
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr <<"Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+
+  // Per-event segmented sum of the tracks.
+  ROOT::TTreeProcessor<std::tuple<int, ROOT::span<float>>> processor({"b", "px"});
+  double total = processor
+    .map([](int, ROOT::span<float> px) -> std::tuple<double> {
+        double sum = 0;
+        for (float x : px) {sum += x;}
+        return sum;
+      })
+    .reduce(0., [](double total, double sum) {return total + sum;})
+    .process("T", {tf});
+  std::cout << "Sum of px: " << total << "\n";
+
+  // Vectorized loop over each event's tracks.
+  ROOT::TTreeProcessor<std::tuple<int, ROOT::span<float>>> processor_vector({"b", "px"});
+  total = processor_vector
+    .map([](int, ROOT::span<float> px) -> std::tuple<double> {
+        ROOT::floatv sum = 0;
+        for (std::size_t idx = 0; idx < px.size(); idx += ROOT::vector_count) {
+            sum(px.mask(idx)) += px.vector(idx);
+        }
+        return sum.sum();
+      })
+    .reduce(0., [](double total, double sum) {return total + sum;})
+    .processParallel("T", {tf});
+  std::cout << "Vectorized sum of px: " << total << "\n";
+
+  // Blocks of 16 events; the tracks of a block are stored contiguously.
+  ROOT::TTreeProcessor<std::tuple<int, ROOT::span<float>>> processor_blocks({"b", "px"});
+  long count = processor_blocks
+    .blocks(16)
+    .filter([](int, ROOT::span<float> px) {return px.size() >= 2;})
+    .map([](int, ROOT::span<float> px) -> std::tuple<long> {return px[1] == px[0] + 1;})
+    .reduce(0l, [](long count, long ok) {return count + ok;})
+    .process("T", {tf});
+  std::cout << "Events with at least two tracks: " << count << "\n";
+
+  // One event per track; the vectorized stage gets full vectors of tracks.
+  ROOT::TTreeProcessor<std::tuple<int, ROOT::span<float>>> processor_tracks({"b", "px"});
+  total = processor_tracks
+    .flatMap<std::tuple<float>>([](int, ROOT::span<float> px, auto &emit) {
+        for (float x : px) {emit(x);}
+      })
+    .map([](ROOT::maskv m, ROOT::floatv px) -> std::tuple<ROOT::floatv> {return {2*px};})
+    .reduce(0.f, [](auto sum, auto px) {return sum + px;})
+    .processParallel("T", {tf});
+  std::cout << "Sum of 2*px over tracks: " << total << "\n";
+
+  // flatMap on a vectorized stream: the vectors are unpacked first.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_repeat(std::make_tuple("a"));
+  count = processor_repeat
+    .filter([](ROOT::maskv, ROOT::floatv a) {return a < 3;})
+    .flatMap<std::tuple<float, int>>([](float a, auto &emit) {
+        for (int copy = 0; copy < a; copy++) {emit(a, copy);}
+      })
+    .count()
+    .map([](float, int) -> std::tuple<long> {return 1;})
+    .reduce(0l, [](long count, long one) {return count + one;})
+    .process("T", {tf});
+  std::cout << "Copies of a < 3: " << count << "\n";
+
+  // Flattened kernels: per-track pt over all events, then per-event sums.
+  ROOT::TJaggedArray<float> px, py, pt;
+  for (int event = 0; event < 6; event++) {
+    std::vector<float> tracks(event % 4, 3.f), other(event % 4, 4.f);
+    px.push_back(tracks.data(), tracks.size());
+    py.push_back(other.data(), other.size());
+  }
+  ROOT::flat_transform(pt, [](ROOT::floatv x, ROOT::floatv y) {return Vc::sqrt(x*x + y*y);}, px, py);
+  std::vector<float> sums;
+  ROOT::segment_reduce(sums, pt, 0.f, [](float sum, float x) {return sum + x;});
+  std::cout << "Per-event pt sums:";
+  for (float sum : sums) {std::cout << " " << sum;}
+  std::cout << "\n";
+
+  return 0;
+}
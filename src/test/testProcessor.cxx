@@ -5,17 +5,21 @@
 #include "TTreeProcessor.h"
 
 
-class MyMapper final : public ROOT::TTreeProcessorMapper<std::tuple<int>, float, int, double> {
+class MyMapper final : public ROOT::TTreeProcessorMapper<std::tuple<int>, float, int, double>, public ROOT::TTreeProcessorThreadLocal {
 public:
   MyMapper(int starter_count) : count(starter_count) {}
+  MyMapper(MyMapper &&) = default;
+  // Each worker thread gets a clone that starts counting from zero.
+  MyMapper(const MyMapper &) : count(0) {}
 
   std::tuple<int> map(float, int, double) const noexcept __attribute__((always_inline)) {count++; return 1;}
 
+  void merge(const MyMapper &clone) {count += clone.count;}
+
   bool finalize() {std::cout << "There were " << count << "events.\n"; return true;}
 
 private:
-  // Hmm... this suppresses move-constructors.
-  //mutable std::atomic<int> count;
+  // Only touched by the owning thread; no atomics needed.
   mutable int count;
 };
 
@@ -40,6 +44,21 @@ int main(int argc, char *argv[])
   .map([](int x) -> std::tuple<int> {std::cout << "Third mapper got X input of " << x << "\n"; return std::make_tuple(x*x+1);})
   .process("T", {TFile::Open(argv[1])});
 
+  // b and c are only read for events passing the leading filter.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_late({"a", "b", "c"});
+  processor_late
+  .filter([](float x, ROOT::unused, ROOT::unused) {return x <= 1;})
+  .map([](float x, int y, double z) -> std::tuple<int> {std::cout << "Late mapper got Y input of " << y << "\n"; return std::make_tuple(y);})
+  .process("T", {TFile::Open(argv[1])});
+
+  // No stage looks at c, so it is never read.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_pruned({"a", "b", "c"});
+  processor_pruned
+  .map([](float x, int y, ROOT::unused) -> std::tuple<float> {return std::make_tuple(x*y);})
+  .filter([](float xy) {return xy > 50;})
+  .count()
+  .process("T", {TFile::Open(argv[1])});
+
   ROOT::TTreeProcessor<std::tuple<float, int, double>, MyMapper> processor2({"a", "b", "c"}, MyMapper(argc));
   processor2.process("T", {TFile::Open(argv[1])});
 
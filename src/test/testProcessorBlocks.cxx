@@ -0,0 +1,50 @@
+
+#include <iostream>
+
+#include "TTreeProcessor.h"
+
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr <<"Usage: " << argv[0] << " fname [fname...] \n";
+    return 1;
+  }
+
+  std::vector<TFile*> tfiles; tfiles.reserve(argc-1);
+  for (int idx=1; idx<argc; idx++) {
+    tfiles.push_back(TFile::Open(argv[idx]));
+  }
+
+  // Same chain as testProcessorParallel, but each stage runs over a block of
+  // 16 events at a time.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor({"a", "b", "c"});
+  processor
+  .blocks(16)
+  .map([](float x, int y, double z) -> std::tuple<int, float> {return {y, x};})
+  .filter([](int x, float y) {return y <= 5;})
+  .map([](int x, float y) -> std::tuple<int> {std::cout << "Apply map to " << y << "\n"; return std::make_tuple(x*x+1);})
+  .count()
+  .processParallel("T", tfiles);
+
+  // A scalar prefix, then a vectorized stage: the block engine hands rows to
+  // the packer one at a time.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_mixed({"a", "b", "c"});
+  processor_mixed
+  .blocks()
+  .filter([](float x, int y, double z) {return x >= 5;})
+  .map([](float x, int y, double z) -> std::tuple<float> {return std::make_tuple(x);})
+  .map([](const ROOT::maskv &m, const ROOT::floatv &x) -> std::tuple<ROOT::floatv> {std::cout << "Vectorized input " << x << " mask " << m << "\n"; return std::make_tuple(x);})
+  .process("T", tfiles);
+
+  // Blocks are cut from clusters decoded ahead of time.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_pipelined({"a", "b", "c"});
+  processor_pipelined
+  .blocks(16)
+  .filter([](float x, int y, double z) {return x <= 5;})
+  .count()
+  .processPipelined("T", tfiles, 2);
+
+  return 0;
+}
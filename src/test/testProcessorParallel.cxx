@@ -1,10 +1,39 @@
 
 #include <atomic>
 #include <iostream>
+#include <limits>
 
 #include "TTreeProcessor.h"
 
 
+// Sums the b branch; each worker thread updates its own clone.
+class SumMapper final : public ROOT::TTreeProcessorMapper<std::tuple<int>, float, int, double>, public ROOT::TTreeProcessorThreadLocal {
+public:
+  SumMapper() {}
+  SumMapper(SumMapper &&) = default;
+  SumMapper(const SumMapper &) {}
+
+  std::tuple<int> map(float, int y, double) const noexcept {sum += y; return std::make_tuple(y);}
+
+  void merge(const SumMapper &clone) {sum += clone.sum;}
+
+  bool finalize() {std::cout << "Sum of b is " << sum << ".\n"; return true;}
+
+private:
+  mutable long sum{0};
+};
+
+// Accumulator for aggregate(): one copy per worker thread, merged at the end.
+struct MinMax {
+  int min{std::numeric_limits<int>::max()};
+  int max{std::numeric_limits<int>::min()};
+  long count{0};
+
+  void operator()(float, int y, double) {min = std::min(min, y); max = std::max(max, y); count++;}
+
+  void merge(const MinMax &other) {min = std::min(min, other.min); max = std::max(max, other.max); count += other.count;}
+};
+
 int main(int argc, char *argv[])
 {
   if (argc < 2)
@@ -26,5 +55,32 @@ int main(int argc, char *argv[])
   .count()
   .processParallel("T", tfiles);
 
+  ROOT::TTreeProcessor<std::tuple<float, int, double>, SumMapper> processor_sum({"a", "b", "c"}, SumMapper());
+  processor_sum.processParallel("T", tfiles);
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_reduce({"a", "b", "c"});
+  double total = processor_reduce
+  .filter([](float x, int y, double z) {return x <= 5;})
+  .map([](float x, int y, double z) -> std::tuple<double> {return std::make_tuple(z);})
+  .reduce(0.0, [](double sum, double z) {return sum + z;})
+  .processParallel("T", tfiles);
+  std::cout << "Sum of c for a <= 5 is " << total << ".\n";
+
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_aggregate({"a", "b", "c"});
+  MinMax range = processor_aggregate
+  .aggregate(MinMax())
+  .processParallel("T", tfiles);
+  std::cout << "b ranges over [" << range.min << ", " << range.max << "] in " << range.count << " events.\n";
+
+  // Same reduction, with decoding of upcoming clusters overlapped with the
+  // chain; at most 4 clusters are in flight.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> processor_pipelined({"a", "b", "c"});
+  total = processor_pipelined
+  .filter([](float x, int y, double z) {return x <= 5;})
+  .map([](float x, int y, double z) -> std::tuple<double> {return std::make_tuple(z);})
+  .reduce(0.0, [](double sum, double z) {return sum + z;})
+  .processPipelined("T", tfiles, 4);
+  std::cout << "Pipelined sum of c for a <= 5 is " << total << ".\n";
+
   return 0;
 }
@@ -1,11 +1,14 @@
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <iostream>
 
 #include "TTreeProcessor.h"
 
 using floatv = ROOT::floatv;
 using maskv  = ROOT::maskv;
+using intv   = ROOT::intv;
 
 int main(int argc, char *argv[])
 {
@@ -20,5 +23,80 @@ int main(int argc, char *argv[])
     .map([](maskv m, floatv in) -> std::tuple<floatv> {std::cout << "New vectorized tuple: " << in << "\n"; return {2*in};})
     .process("T", {TFile::Open(argv[1])});
 
-  return 0;
+  // Lanes rejected by the filter stay masked for the later stages.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_filter(std::make_tuple("a"));
+  processor_filter
+    .filter([](maskv m, floatv in) {return in <= 5;})
+    .map([](maskv m, floatv in) -> std::tuple<floatv> {return {2*in};})
+    .map([](maskv m, floatv in) -> std::tuple<floatv> {std::cout << "Filtered tuple: " << in << " mask " << m << "\n"; return {in};})
+    .process("T", {TFile::Open(argv[1])});
+
+  // After a selective cut, compact() repacks the surviving lanes.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_compact(std::make_tuple("a"));
+  processor_compact
+    .filter([](maskv m, floatv in) {return in < 2;})
+    .compact()
+    .map([](maskv m, floatv in) -> std::tuple<floatv> {std::cout << "Compacted tuple: " << in << " mask " << m << "\n"; return {in};})
+    .processParallel("T", {TFile::Open(argv[1])});
+
+  // Mixed chain: the scalar-only stage is fed one lane at a time, then the
+  // stream is packed back into vectors for the last stage.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_mixed(std::make_tuple("a"));
+  processor_mixed
+    .map([](maskv m, floatv in) -> std::tuple<floatv> {return {in*in};})
+    .map([](float x) -> std::tuple<float, int> {return std::make_tuple(x, static_cast<int>(std::sqrt(x)));})
+    .map([](maskv m, floatv x, intv root) -> std::tuple<floatv> {std::cout << "Repacked tuple: " << x << " roots " << root << " mask " << m << "\n"; return {x};})
+    .process("T", {TFile::Open(argv[1])});
+
+  // Lane-wise reduction; lanes masked off by the filter do not contribute.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_reduce(std::make_tuple("a"));
+  float total = processor_reduce
+    .filter([](maskv m, floatv in) {return in <= 5;})
+    .reduce(0.f, [](auto sum, auto in) {return sum + in;})
+    .processParallel("T", {TFile::Open(argv[1])});
+  std::cout << "Sum of a <= 5 is " << total << "\n";
+
+  ROOT::TTreeProcessor<std::tuple<float>> processor_pipelined(std::make_tuple("a"));
+  total = processor_pipelined
+    .filter([](maskv m, floatv in) {return in <= 5;})
+    .reduce(0.f, [](auto sum, auto in) {return sum + in;})
+    .processPipelined("T", {TFile::Open(argv[1])});
+  std::cout << "Pipelined sum of a <= 5 is " << total << "\n";
+
+  // A scalar-only combine is fed one lane at a time.
+  ROOT::TTreeProcessor<std::tuple<float>> processor_reduce_scalar(std::make_tuple("a"));
+  float largest = processor_reduce_scalar
+    .filter([](maskv m, floatv in) {return in <= 5;})
+    .reduce(0.f, [](float max, float in) {return std::max(max, in);})
+    .process("T", {TFile::Open(argv[1])});
+  std::cout << "Largest a <= 5 is " << largest << "\n";
+
+  // Narrow and 64-bit integer branches are bulk-read and stay vectorized.
+  TFile *types_file = TFile::Open("vectorized_types.root", "RECREATE");
+  TTree *types_tree = new TTree("T", "Integer branches");
+  Short_t s;
+  UChar_t u;
+  Long64_t l;
+  types_tree->Branch("s", &s);
+  types_tree->Branch("u", &u);
+  types_tree->Branch("l", &l);
+  Long64_t expected = 0;
+  for (Long64_t idx = 0; idx < 1003; idx++) {
+    s = idx % 200 - 100;
+    u = idx % 256;
+    l = idx * 10000000000LL;
+    types_tree->Fill();
+    if (s < 0 && u > 50) {expected += l / 10000000000LL;}
+  }
+  types_tree->Write();
+
+  ROOT::TTreeProcessor<std::tuple<Short_t, UChar_t, Long64_t>> processor_types({"s", "u", "l"});
+  Long64_t types_total = processor_types
+    .filter([](maskv m, ROOT::shortv s, ROOT::ushortv u, ROOT::long64v l) {return Vc::simd_cast<maskv>(s < ROOT::shortv(0)) && Vc::simd_cast<maskv>(u > ROOT::ushortv(50));})
+    .map([](maskv m, ROOT::shortv, ROOT::ushortv, ROOT::long64v l) -> std::tuple<ROOT::long64v> {return {l / ROOT::long64v(10000000000LL)};})
+    .reduce(0LL, [](Long64_t sum, Long64_t x) {return sum + x;})
+    .processParallel("T", {types_file});
+  std::cout << "Sum of integer branches is " << types_total << " (expected " << expected << ")\n";
+
+  return (types_total == expected) ? 0 : 1;
 }
@@ -1,6 +1,10 @@
 
+#include <cmath>
+#include <iostream>
+
 #include "RootHelpers.h"
 
+#include "TBufferFile.h"
 #include "TFile.h"
 
 typedef std::tuple<int, float> MyBranchTypes;
@@ -10,8 +14,45 @@ static_assert( std::is_same< std::tuple<std::shared_ptr<TTreeReaderValue<int>>,
                            >::value,
                "");
 
+static_assert(ROOT::internal::is_bulk_readable<std::tuple<float, int, double, unsigned>>::value, "Primitive branches should be bulk-readable.");
+static_assert(ROOT::internal::is_bulk_readable<std::tuple<short, unsigned short, unsigned char, long long>>::value, "Narrow and 64-bit integer branches should be bulk-readable.");
+static_assert(!ROOT::internal::is_bulk_readable<std::tuple<float, std::string>>::value, "Object branches are not bulk-readable.");
+
+static void write_packed(TBufferFile &buf, float value, TStreamerElement *element) {buf.WriteFloat16(&value, element);}
+static void write_packed(TBufferFile &buf, double value, TStreamerElement *element) {buf.WriteDouble32(&value, element);}
+static void read_packed(TBufferFile &buf, float &value, TStreamerElement *element) {buf.ReadFloat16(&value, element);}
+static void read_packed(TBufferFile &buf, double &value, TStreamerElement *element) {buf.ReadDouble32(&value, element);}
+
+/**
+ * Serialize a few values with TBufferFile using the given range spec, then
+ * check that TPackedFloat decodes them exactly as TBufferFile does.
+ */
+template<typename T>
+static bool check_packed(const char *spec) {
+  bool isFloat16 = std::is_same<T, float>::value;
+  TStreamerElement element("x", spec, 0, 0, isFloat16 ? "Float16_t" : "Double32_t");
+  const int count = 2*ROOT::vector_count + 3;
+  TBufferFile buf(TBuffer::kWrite);
+  for (int idx = 0; idx < count; idx++) {write_packed(buf, static_cast<T>(25*std::sin(idx)), &element);}
+
+  std::vector<T> decoded(count);
+  ROOT::internal::TPackedFloat(&element, isFloat16).decode(buf.Buffer(), decoded.data(), count);
+  buf.SetBufferOffset(0);
+  for (int idx = 0; idx < count; idx++) {
+    T expected;
+    read_packed(buf, expected, &element);
+    if (decoded[idx] != expected) {
+      std::cerr << (isFloat16 ? "Float16_t" : "Double32_t") << spec << ": value " << idx << " decoded as " << decoded[idx] << " instead of " << expected << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
 
-  return 0;
+  bool ok = check_packed<float>("") && check_packed<float>("[0,0,10]") && check_packed<float>("[-30,30,16]") &&
+            check_packed<double>("") && check_packed<double>("[0,0,14]") && check_packed<double>("[-30,30,32]");
+  return ok ? 0 : 1;
 }
 
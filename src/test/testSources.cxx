@@ -0,0 +1,84 @@
+
+#include <cmath>
+#include <iostream>
+
+#include "TTreeProcessor.h"
+
+/**
+ * Run the same chain, scalar, vectorized and in parallel, over events held
+ * in memory and over synthetic events, and check that all modes agree.
+ */
+
+typedef std::tuple<float, int, double> Event;
+
+static_assert(!ROOT::internal::has_bool_column<Event>::value, "Event has no bool column.");
+static_assert(ROOT::internal::has_bool_column<std::tuple<float, bool>>::value, "Sources should refuse bool columns.");
+
+template<typename Source>
+static double
+scalar_sum(const Source &source, bool parallel) {
+  ROOT::TTreeProcessor<Event> processor({"a", "b", "c"});
+  auto chain = processor
+    .filter([](float a, int, double) {return a < 0.5;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;});
+  return parallel ? chain.processParallel(source) : chain.process(source);
+}
+
+template<typename Source>
+static double
+vectorized_sum(const Source &source, bool parallel) {
+  ROOT::TTreeProcessor<Event> processor({"a", "b", "c"});
+  auto chain = processor
+    .filter([](ROOT::maskv, ROOT::floatv a, ROOT::intv, ROOT::doublev) {return a < 0.5f;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;});
+  return parallel ? chain.processParallel(source) : chain.process(source);
+}
+
+template<typename Source>
+static bool
+check(const std::string &label, const Source &source, double expected) {
+  double sums[] = {scalar_sum(source, false), scalar_sum(source, true),
+                   vectorized_sum(source, false), vectorized_sum(source, true)};
+  bool ok = true;
+  // Events are summed in a different order by each mode.
+  for (double sum : sums) {ok = ok && std::abs(sum - expected) <= 1e-9 * std::abs(expected);}
+  std::cout << label << ": " << sums[0] << " " << sums[1] << " " << sums[2] << " " << sums[3]
+            << " (expected " << expected << ")" << (ok ? "" : " MISMATCH") << "\n";
+  return ok;
+}
+
+int main()
+{
+  // Not a whole number of vectors, nor of source chunks.
+  const Long64_t entries = 10003;
+  std::vector<float> a(entries);
+  std::vector<int> b(entries);
+  std::vector<double> c(entries);
+  double expected = 0;
+  for (Long64_t idx = 0; idx < entries; idx++) {
+    a[idx] = (idx % 10) / 10.f;
+    b[idx] = idx;
+    c[idx] = idx * 0.5;
+    if (a[idx] < 0.5) {expected += a[idx]*b[idx] + c[idx];}
+  }
+  bool ok = check("Memory", ROOT::TMemorySource<Event>(a, b, c), expected);
+
+  ROOT::TSyntheticSource<Event> synthetic(entries, 42);
+  ROOT::TTreeProcessor<Event> processor({"a", "b", "c"});
+  auto columns = processor.collect().processParallel(synthetic);
+  ok = ok && std::get<0>(columns).size() == static_cast<std::size_t>(entries);
+  expected = 0;
+  for (Long64_t idx = 0; idx < entries; idx++) {
+    float sa = std::get<0>(columns)[idx];
+    ok = ok && sa >= 0 && sa < 1 && std::get<1>(columns)[idx] >= 0 && std::get<1>(columns)[idx] < 100;
+    if (sa < 0.5) {expected += sa*std::get<1>(columns)[idx] + std::get<2>(columns)[idx];}
+  }
+  ok = check("Synthetic", synthetic, expected) && ok;
+
+  // A collected column feeds a memory source directly.
+  ok = check("Collected", ROOT::TMemorySource<Event>(columns), expected) && ok;
+
+  return ok ? 0 : 1;
+}
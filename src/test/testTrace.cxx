@@ -0,0 +1,75 @@
+
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+#include "TTreeProcessor.h"
+
+/**
+ * Trace processParallel passes over a file and check that the task spans
+ * of the timeline cover every entry exactly once, alongside the reader
+ * setup and the read / compute spans.
+ */
+
+static bool
+check_trace(const std::string &fileName, Long64_t entries, const std::vector<std::string> &spans) {
+  std::ifstream in(fileName);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::string trace = ss.str();
+
+  std::regex task("\"name\": \"task\".*\"start\": ([0-9]+), \"end\": ([0-9]+)");
+  Long64_t covered = 0, tasks = 0;
+  for (std::sregex_iterator it(trace.begin(), trace.end(), task), last; it != last; ++it) {
+    covered += std::stoll((*it)[2]) - std::stoll((*it)[1]);
+    tasks++;
+  }
+  bool ok = covered == entries;
+  for (const auto &span : spans) {
+    if (trace.find("\"name\": \"" + span + "\"") == std::string::npos) {
+      std::cout << "No " << span << " span in " << fileName << "\n";
+      ok = false;
+    }
+  }
+  std::cout << fileName << ": " << tasks << " tasks covering " << covered << " entries (expected " << entries << ")\n";
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " fname\n";
+    return 1;
+  }
+
+  TFile *tf = TFile::Open(argv[1]);
+  TTree *tree = static_cast<TTree*>(tf->GetObjectChecked("T", "TTree"));
+  if (!tree) {
+    std::cerr << "No tree named T in " << argv[1] << "\n";
+    return 1;
+  }
+
+  // Scalar chains read through the TTreeReader.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> scalar({"a", "b", "c"});
+  scalar
+    .filter([](float a, int, double) {return a < 5;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .trace("trace_scalar.json")
+    .processParallel("T", {tf});
+  bool ok = check_trace("trace_scalar.json", tree->GetEntries(), {"open file", "build reader", "read+compute"});
+
+  // Vectorized chains decode baskets in bulk, then compute.
+  ROOT::TTreeProcessor<std::tuple<float, int, double>> vectorized({"a", "b", "c"});
+  vectorized
+    .filter([](ROOT::maskv, ROOT::floatv a, ROOT::intv, ROOT::doublev) {return a < 5;})
+    .map([](float a, int b, double c) -> std::tuple<double> {return a*b + c;})
+    .reduce(0., [](double sum, double x) {return sum + x;})
+    .trace("trace_vectorized.json")
+    .processParallel("T", {tf});
+  ok = check_trace("trace_vectorized.json", tree->GetEntries(), {"open file", "build reader", "read", "compute"}) && ok;
+
+  return ok ? 0 : 1;
+}
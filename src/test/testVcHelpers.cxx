@@ -82,5 +82,22 @@ static_assert(!std::is_same< vectorized_tuple_t<std::tuple<int, float>>, std::tu
 
 static_assert(is_vectorized_stream<std::tuple<float>, VectorMap1>::value, "Incorrectly marked as not-vectorized.");
 
+static_assert(is_vectorized_tuple<std::tuple<maskv, floatv>>::value, "Mask-led tuple is vectorized.");
+static_assert(!is_vectorized_tuple<std::tuple<float, floatv>>::value, "Scalar tuple is not vectorized.");
+
+static_assert(std::is_same< vectorized_result_t<std::tuple<floatv>>, std::tuple<maskv, floatv> >::value, "Mapper output should gain the mask.");
+static_assert(std::is_same< vectorized_result_t<std::tuple<maskv, floatv>>, std::tuple<maskv, floatv> >::value, "Mapper output already has a mask.");
+static_assert(std::is_same< vectorized_result_t<floatv>, std::tuple<maskv, floatv> >::value, "Single mapper output should gain the mask.");
+
+static_assert(std::is_same< scalar_tuple_t<std::tuple<maskv, floatv, intv>>, std::tuple<float, int> >::value, "Unpacked to wrong type.");
+
+static_assert(std::is_same< vectorized_tuple_t<std::tuple<short, unsigned short, long long>>, std::tuple<maskv, shortv, ushortv, long64v> >::value, "Converted to wrong type.");
+static_assert(std::is_same< vectorized_tuple_t<std::tuple<unsigned char, bool>>, std::tuple<maskv, ushortv, ushortv> >::value, "8-bit types should widen to 16-bit lanes.");
+static_assert(std::is_same< scalar_tuple_t<std::tuple<maskv, shortv, long64v>>, std::tuple<short, long long> >::value, "Unpacked to wrong type.");
+static_assert(std::is_same< decltype(long64v(1) < long64v(2)), maskv >::value, "64-bit comparisons should yield the stream's mask.");
+
+static_assert(is_callable_with_tuple<int(*)(float, int), std::tuple<float, int>>::value, "Should be callable.");
+static_assert(!is_callable_with_tuple<int(*)(floatv), std::tuple<maskv, floatv>>::value, "Should not be callable.");
+
 int main(int argc, char *argv[]) {return 0;}
 